@@ -1,8 +1,26 @@
 #include "2d.h"
+#include <assert.h>
+#include <string.h>
 SDL_Window* window = NULL;
 SDL_Surface* surface = NULL;
 uint32_t bg_data[256 * 256 + 256];
-uint32_t palette_data[16];
+uint16_t ppu_pixels[256 * 240];
+BackgroundCache background;
+RenderInputs frame_inputs;
+RenderWorker renderer;
+FrameFilter filter;
+vector<uint32_t> filtered;
+
+Movie movie;
+VideoWriter video;
+HashLog hashes;
+Debugger debugger(famicom);
+DiffHarness diff;
+
+int fast_forward_frames = 0;
+int frame_skip = 4;
+bool turbo = false;
+bool pipelined = false;
 
 int key_map[] = {
     SDLK_j,
@@ -15,65 +33,119 @@ int key_map[] = {
     SDLK_d
 };
 
-uint32_t GetPixel(unsigned x, unsigned y, const uint8_t* nt, const uint8_t* bg) {
-    // 获取所在名称表
-
-    const unsigned id = (x >> 3) + (y >> 3) * 32;
-
-    const uint32_t name = nt[id];
-    // 查找对应图样表
-    const uint8_t* nowp0 = bg + name * 16;
-    const uint8_t* nowp1 = nowp0 + 8;
+// runs on the render worker when pipelined
+static void RasterizeFrame(const RenderInputs& inputs, BackgroundCache& cache,
+    uint16_t* pixels, uint32_t* rgba) {
+    cache.Update(inputs);
+    RasterState state = inputs.raster_start;
+    // the plane is drawn with the pattern table the frame starts with
+    const int cached_table = BackgroundTable(state.ctrl);
+    // the vertical scroll is only taken at the start of a frame
+    const unsigned y = state.scroll[1] + (state.ctrl >> 1 & 1) * 240;
+    uint8_t indices[256];
+    // colours are kept current by the machine and ApplyRaster
+    const uint32_t* const palette_data = state.colors;
+    uint16_t pixel_data[16];
+    size_t next = 0;
+    // spans of lines between raster writes
+    for (unsigned line = 0; line < 240; ) {
+        while (next != inputs.raster_count && RasterLine(inputs.raster[next]) <= line)
+            ApplyRaster(inputs.raster[next++], inputs.palette_lut, state);
+        unsigned end = 240;
+        if (next != inputs.raster_count && RasterLine(inputs.raster[next]) < end)
+            end = RasterLine(inputs.raster[next]);
 
-    // Y坐标为平面内偏移
-    const int offset = y & 0x7;
-    const uint8_t p0 = nowp0[offset];
-    const uint8_t p1 = nowp1[offset];
-
-    // X坐标为字节内偏移
-    const uint8_t shift = (~x) & 0x7;
-    const uint8_t mask = 1 << shift;
-    // 计算低二位
-    const uint8_t low = ((p0 & mask) >> shift) | ((p1 & mask) >> shift << 1);
-    // 计算所在属性表
-    const unsigned aid = (x >> 5) + (y >> 5) * 8;
-    const uint8_t attr = nt[aid + (32*30)];
-    // 获取属性表内位偏移
-    const uint8_t aoffset = ((x & 0x10) >> 3) | ((y & 0x10) >> 2);
-    // 计算高两位
-    const uint8_t high = (attr & (3 << aoffset)) >> aoffset << 2;
-    // 合并作为颜色
-    const uint8_t index = high | low;
+        for (int i = 0; i != 16; ++i) {
+            pixel_data[i] = PpuPixel(state.spindexes[i & 3 ? i : 0], state.mask);
+        }
 
-    return palette_data[index];
+        uint32_t* out = rgba + line * 256;
+        uint16_t* ppu = pixels + line * 256;
+        // 背景: scrolled window of the cached nametable plane
+        const unsigned x = state.scroll[0] + (state.ctrl & 1) * 256;
+        const int table = BackgroundTable(state.ctrl);
+        for (; line != end; ++line, out += 256, ppu += 256) {
+            if (!(state.mask & PPU2001_Back)) {
+                // rendering off shows the backdrop
+                for (int i = 0; i != 256; ++i) out[i] = palette_data[0];
+                for (int i = 0; i != 256; ++i) ppu[i] = pixel_data[0];
+                continue;
+            }
+            if (table == cached_table) cache.Window(x, y + line, 1, indices);
+            else DrawPlaneLine(inputs, table, x, y + line, indices);
+            for (int i = 0; i != 256; ++i) out[i] = palette_data[indices[i]];
+            for (int i = 0; i != 256; ++i) ppu[i] = pixel_data[indices[i]];
+        }
+    }
+}
+void RenderFrame(uint32_t* rgba) {
+    CaptureRenderInputs(famicom, frame_inputs);
+    frame_inputs.state_hash = hashes.IsOpen() ? famicom.StateHash() : 0;
+    RasterizeFrame(frame_inputs, background, ppu_pixels, rgba);
+}
+static void AdvanceFrame() {
+    // input is recorded/injected at frame boundaries only
+    movie.Frame(famicom);
+    famicom.RunFrame();
+}
+static const uint32_t* FilterFrame(const RenderInputs& inputs, const uint16_t* pixels, const uint32_t* rgba) {
+    if (filter.Kind() == FILTER_NONE) return rgba;
+    filtered.resize((size_t)filter.Width() * filter.Height());
+    filter.Apply(rgba, pixels, inputs.frame, filtered.data());
+    return filtered.data();
+}
+// video gets the filtered frame, hashes are of the rendered one
+static bool CaptureFrame(const RenderInputs& inputs, const uint32_t* rgba, const uint32_t* shown) {
+    video.Push(shown);
+    if (!hashes.IsOpen()) return true;
+    return hashes.Frame(inputs.frame,
+        Hash64(rgba, 256 * 240 * sizeof(uint32_t)), inputs.state_hash);
+}
+static bool SinkFrame(const RenderInputs& inputs, const uint16_t* pixels, const uint32_t* rgba) {
+    return CaptureFrame(inputs, rgba, video.IsOpen() ? FilterFrame(inputs, pixels, rgba) : rgba);
 }
 extern void MainRender(uint32_t* rgba) {
-    uint32_t* data = rgba;
-    for (int i = 0; i != 10000; ++i)
-        famicom.cpu_->ExecuteOne();
-
-    famicom.sVblank();
-    if (famicom.ppu_.ctrl & (uint8_t)PPU2000_NMIGen) {
-        famicom.cpu_->NMI();
-    }
-
-    // 生成调色板颜色
-    {
-        for (int i = 0; i != 16; ++i) {
-            palette_data[i] = palette[famicom.ppu_.spindexes[i]].data;
+    AdvanceFrame();
+    RenderFrame(rgba);
+}
+void RunFrames(int frames) {
+    // logic only: no pixels, no palette, no present
+    for (int i = 0; i < frames; ++i)
+        AdvanceFrame();
+}
+bool RunHeadless(int frames){
+    const uint32_t start = SDL_GetTicks();
+    // turbo renders every frame_skip-th frame, otherwise only the last one
+    // unless the frames are captured
+    const bool capture = video.IsOpen() || hashes.IsOpen();
+    const int skip = turbo ? frame_skip : capture ? 1 : frames;
+    int rendered = 0;
+    bool ok = true;
+    // frame N is rasterized and captured while frame N+1 runs
+    if (pipelined) renderer.Start(RasterizeFrame, SinkFrame);
+    for (int i = 1; i <= frames && ok; ++i) {
+        AdvanceFrame();
+        // the harness already printed the mismatch
+        if (diff.Failed()) ok = false;
+        if (i % skip == 0 || i == frames) {
+            if (pipelined) {
+                renderer.Submit(famicom, hashes.IsOpen() ? famicom.StateHash() : 0);
+                if (renderer.Failed()) ok = false;
+            }
+            else {
+                RenderFrame(bg_data);
+                ok = SinkFrame(frame_inputs, ppu_pixels, bg_data);
+            }
+            ++rendered;
         }
-        palette_data[4 * 1] = palette_data[0];
-        palette_data[4 * 2] = palette_data[0];
-        palette_data[4 * 3] = palette_data[0];
     }
-    // 背景
-    const uint8_t* now = famicom.ppu_.banks[8];
-    const uint8_t* bgp = famicom.ppu_.banks[
-        famicom.ppu_.ctrl & PPU2000_BgTabl ? 4 : 0];
-    for (unsigned i = 0; i != 256 * 240; ++i) {
-        data[i] = GetPixel(i & 0xff, i >> 8, now, bgp);
+    if (pipelined) {
+        renderer.Finish();
+        if (renderer.Failed()) ok = false;
     }
-
+    const uint32_t ms = SDL_GetTicks() - start;
+    printf("%d frames (%d rendered) in %u ms\n", frames, rendered, (unsigned)ms);
+    return ok;
 }
 void UserInput(int index, unsigned char data){
     assert(index >= 0 && index < 16);
@@ -81,10 +153,21 @@ void UserInput(int index, unsigned char data){
 }
 void CreateWindow(){
     SDL_Init(SDL_INIT_VIDEO);
-    window = SDL_CreateWindow("SDL", 100, 100, 256, 240, SDL_WINDOW_SHOWN);
+    const int width = filter.Width();
+    const int height = filter.Height();
+    window = SDL_CreateWindow("SDL", 100, 100, width, height, SDL_WINDOW_SHOWN);
     surface = SDL_GetWindowSurface(window);
+    // video and hashes are of RGBA frames, the window alone can take the
+    // surface's byte order
+    const Uint32 format = surface->format->format;
+    if (!video.IsOpen() && !hashes.IsOpen()
+        && (format == SDL_PIXELFORMAT_ARGB8888 || format == SDL_PIXELFORMAT_RGB888)) {
+        famicom.SetPixelFormat(PIXEL_BGRA);
+        filter.SetPixelFormat(PIXEL_BGRA);
+    }
     bool quit = false;
     SDL_Event e;
+    RunFrames(fast_forward_frames);
     while(!quit){
         for(int i=0;i<8;i++){
             UserInput(i, 0);
@@ -92,6 +175,13 @@ void CreateWindow(){
         while( SDL_PollEvent( &e ) != 0 ){
             if(e.type == SDL_QUIT) quit = true;
             if(e.type == SDL_KEYDOWN){
+                // Tab: toggle turbo
+                if(e.key.keysym.sym == SDLK_TAB && !e.key.repeat) turbo = !turbo;
+                // F12: break into the debugger prompt on the console
+                if(e.key.keysym.sym == SDLK_F12 && !e.key.repeat){
+                    famicom.cpu_.debugger_ = &debugger;
+                    debugger.Interrupt();
+                }
                 for(int i=0;i<8;i++){
                     UserInput(i, key_map[i] == e.key.keysym.sym);
                 }
@@ -99,9 +189,13 @@ void CreateWindow(){
         }
         uint32_t color = SDL_MapRGB(surface->format, 0xff, 0, 0);
         uint32_t* pixel = (uint32_t*)surface->pixels;
+        // turbo: only every frame_skip-th frame is drawn and presented
+        if(turbo) RunFrames(frame_skip - 1);
         MainRender(bg_data);
-        for(int i = 0; i < 256*240; i++)
-            pixel[i] = bg_data[i];
+        const uint32_t* shown = FilterFrame(frame_inputs, ppu_pixels, bg_data);
+        CaptureFrame(frame_inputs, bg_data, shown);
+        for(int y = 0; y < height; y++)
+            memcpy((uint8_t*)pixel + y * surface->pitch, shown + y * width, width * sizeof(uint32_t));
         SDL_UnlockSurface(surface);
         SDL_UpdateWindowSurface(window);
     }
@@ -1,10 +1,16 @@
 #include "6502.h"
 
-Addressing::Addressing(Famicom* fa){
+Addressing::Addressing(Famicom* fa, CpuState* state){
     famicom_ = fa;
+    hot_ = state;
+    debugger_ = fa->cpu_.debugger_;
+    diff_ = fa->cpu_.diff_;
 }
-Operation::Operation(Famicom* fa){
+Operation::Operation(Famicom* fa, CpuState* state){
     famicom_ = fa;
+    hot_ = state;
+    debugger_ = fa->cpu_.debugger_;
+    diff_ = fa->cpu_.diff_;
 }
 
 // Addressing
@@ -36,13 +42,17 @@ uint16_t Addressing::ABX(){
     // Absolute X Addressing
     // 绝对X变址
     const uint16_t base = ABS();
-    return base + (uint16_t)REG_X;
+    const uint16_t address = base + (uint16_t)REG_X;
+    hot_->page_crossed = ((base ^ address) & (uint16_t)0xFF00) != 0;
+    return address;
 }
 uint16_t Addressing::ABY(){
     // Absolute Y Addressing
     // 绝对Y变址
     const uint16_t base = ABS();
-    return base + (uint16_t)REG_Y;
+    const uint16_t address = base + (uint16_t)REG_Y;
+    hot_->page_crossed = ((base ^ address) & (uint16_t)0xFF00) != 0;
+    return address;
 }
 uint16_t Addressing::ZPG(){
     // Zero-Page  Addressing
@@ -84,7 +94,10 @@ uint16_t Addressing::INY(){
     uint8_t base = Read(REG_PC++);
     const uint8_t address0 = Read(base++);
     const uint8_t address1 = Read(base++);
-    return ((uint16_t) address0 | (uint16_t) ((uint16_t) address1 << 8)) + (uint16_t)REG_Y;
+    const uint16_t temp = (uint16_t) address0 | (uint16_t) ((uint16_t) address1 << 8);
+    const uint16_t address = temp + (uint16_t)REG_Y;
+    hot_->page_crossed = ((temp ^ address) & (uint16_t)0xFF00) != 0;
+    return address;
 }
 uint16_t Addressing::REL(){
     // Relative Addressing
@@ -95,13 +108,18 @@ uint16_t Addressing::REL(){
 }
 
 // Operation
+void Operation::Branch(uint16_t address){
+    // taken branch: +1 cycle, +1 more when crossing a page
+    hot_->cycle += MASTER_PER_CPU * (((REG_PC ^ address) & (uint16_t)0xFF00) ? 2 : 1);
+    REG_PC = address;
+}
 void Operation::ADC(uint16_t address){
     // Add with carry
     const uint8_t src = Read(address);
     const uint16_t res16 = (uint16_t)REG_A + (uint16_t)src + (REG_CF ? 1 : 0);
     REG_CF_IF(res16 >> 8);
     const uint8_t res8 = (uint8_t)res16;
-    REG_VF_IF(!((REG_A ^ src) & 0x80) && ((REG_A ^ res8) & 0x80));
+    REG_VF_BIT7(~(REG_A ^ src) & (REG_A ^ res8));
     REG_A = res8;
     CHECK_ZSFLAG(REG_A);
 }
@@ -120,30 +138,30 @@ void Operation::ASL(uint16_t address){
 }
 void Operation::BCC(uint16_t address){
     // Branch if carry clear
-    if(!REG_CF) REG_PC = address;
+    if(!REG_CF) Branch(address);
 }
 void Operation::BEQ(uint16_t address){
     // Branch if equal
-    if(REG_ZF) REG_PC = address;
+    if(REG_ZF) Branch(address);
 }
 void Operation::BIT(uint16_t address){
     // BIT Test bits in memory with accumulator
     const uint8_t value = Read(address);
-    REG_NF_IF((value >> 7) & 1);
-    REG_VF_IF((value >> 6) & 1);
-    REG_ZF_IF(!(REG_A & value));
+    REG.nflag = value;
+    REG_VF_BIT7(value << 1);
+    REG.zflag = REG_A & value;
 }
 void Operation::BMI(uint16_t address){
     // Branch on result minus
-    if(REG_NF) REG_PC = address;
+    if(REG_NF) Branch(address);
 }
 void Operation::BNE(uint16_t address){
     // Branch if not equal
-    if(!REG_ZF) REG_PC = address;
+    if(!REG_ZF) Branch(address);
 }
 void Operation::BPL(uint16_t address){
     // Branch on result plus
-    if(!REG_NF) REG_PC = address;
+    if(!REG_NF) Branch(address);
 }
 void Operation::BRK(uint16_t address){
     // Forced Interrupt PC + 2 toS P toS
@@ -152,15 +170,15 @@ void Operation::BRK(uint16_t address){
 }
 void Operation::BSC(uint16_t address){
     // Branch if carry set
-    if(REG_CF) REG_PC = address;
+    if(REG_CF) Branch(address);
 }
 void Operation::BVC(uint16_t address){
     // Branch on overflow clear
-    if(!REG_VF) REG_PC = address;
+    if(!REG_VF) Branch(address);
 }
 void Operation::BVS(uint16_t address){
     // Branch on overflow set
-    if(REG_VF) REG_PC = address;
+    if(REG_VF) Branch(address);
 }
 void Operation::CLC(uint16_t address){
     // Clear carry
@@ -169,6 +187,8 @@ void Operation::CLC(uint16_t address){
 void Operation::CLI(uint16_t address){
     // Clear interrupt disable bit
     REG_IF_CL;
+    // leave the run loop so a pending IRQ gets taken
+    if (famicom_->irq_lines_) hot_->deadline = 0;
 }
 void Operation::CLD(uint16_t address){
     // Clear decimal mode
@@ -287,7 +307,7 @@ void Operation::PHA(uint16_t address){
 }
 void Operation::PHP(uint16_t address){
     // Push processor status on stack
-    PUSH(REG_P | (uint8_t)(FLAG_B | FLAG_R))
+    PUSH(REG.Status() | (uint8_t)(FLAG_B | FLAG_R))
 }
 void Operation::PLA(uint16_t address){
     // Pull accumulator from stack
@@ -296,9 +316,11 @@ void Operation::PLA(uint16_t address){
 }
 void Operation::PLP(uint16_t address){
     // Pull Processor Status from Stack
-    REG_P = POP();
+    const uint8_t status = POP();
+    REG.SetStatus(status);
     REG_RF_SE;
     REG_BF_CL;
+    if (famicom_->irq_lines_ && !REG_IF) hot_->deadline = 0;
 }
 
 void Operation::RTS(uint16_t address){
@@ -310,12 +332,14 @@ void Operation::RTS(uint16_t address){
 }
 void Operation::RTI(uint16_t address){
     // Return from interrupt
-    REG_P = POP();
+    const uint8_t status = POP();
+    REG.SetStatus(status);
     REG_RF_SE;
     REG_BF_CL;
     const uint8_t pcl = POP();
     const uint8_t pch = POP();
     REG_PC = (uint16_t)pcl | ((uint16_t) pch << 8);
+    if (famicom_->irq_lines_ && !REG_IF) hot_->deadline = 0;
 }
 void Operation::ROL(uint16_t address){
     //Rotate One Bit Left (Memory)
@@ -341,7 +365,7 @@ void Operation::SBC(uint16_t address){
     const uint16_t res16 = (uint16_t)REG_A - (uint16_t)src - (REG_CF ? 0 : 1);
     REG_CF_IF(!(res16 >> 8));
     const uint8_t res8 = (uint8_t)res16;
-    REG_VF_IF(((REG_A ^ src) & 0x80) && ((REG_A ^ res8) & 0x80));
+    REG_VF_BIT7((REG_A ^ src) & (REG_A ^ res8));
     REG_A = res8;
     CHECK_ZSFLAG(REG_A);
 }
@@ -465,7 +489,7 @@ void Operation::ISB(uint16_t address){
     const uint16_t res16 = (uint16_t)REG_A - (uint16_t)src - (REG_CF ? 0 : 1);
     REG_CF_IF(!(res16 >> 8));
     const uint8_t res8 = (uint8_t)res16;
-    REG_VF_IF(((REG_A ^ src) & 0x80) && ((REG_A ^ res8) & 0x80));
+    REG_VF_BIT7((REG_A ^ src) & (REG_A ^ res8));
     REG_A = res8;
     CHECK_ZSFLAG(REG_A);
 }
@@ -525,7 +549,7 @@ void Operation::RRA(uint16_t address){
     const uint16_t res16 = (uint16_t)REG_A + (uint16_t)src + (REG_CF ? 1 : 0);
     REG_CF_IF(res16 >> 8);
     const uint8_t res8 = (uint8_t)res16;
-    REG_VF_IF(!((REG_A ^ src) & 0x80) && ((REG_A ^ res8) & 0x80));
+    REG_VF_BIT7(~(REG_A ^ src) & (REG_A ^ res8));
     REG_A = res8;
     CHECK_ZSFLAG(REG_A);
 }
\ No newline at end of file
@@ -4,7 +4,7 @@
 #include "cpu.h"
 class Addressing : public Cpu{
 public:
-    Addressing(Famicom*);
+    Addressing(Famicom*, CpuState*);
     uint16_t UNK();
     uint16_t ACC();
     uint16_t IMP();
@@ -22,8 +22,10 @@ public:
 };
 
 class Operation : public Cpu{
+private:
+    void Branch(uint16_t);
 public:
-    Operation(Famicom*);
+    Operation(Famicom*, CpuState*);
     void ADC(uint16_t);
     void AND(uint16_t);
     void ASL(uint16_t);
@@ -0,0 +1,59 @@
+#include "bands.h"
+
+BandPool::~BandPool(){
+    Stop();
+}
+
+void BandPool::Stop(){
+    {
+        lock_guard<mutex> guard(lock_);
+        closing_ = true;
+    }
+    begin_.notify_all();
+    for (size_t i = 0; i != workers_.size(); ++i) workers_[i].join();
+    workers_.clear();
+    closing_ = false;
+}
+
+void BandPool::Start(int threads, BandJob job, void* context){
+    Stop();
+    job_ = job;
+    context_ = context;
+    for (int band = 1; band < threads; ++band)
+        workers_.push_back(thread(&BandPool::Worker, this, band));
+}
+
+void BandPool::Worker(int band){
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            unique_lock<mutex> guard(lock_);
+            begin_.wait(guard, [&]{ return closing_ || generation_ != seen; });
+            if (closing_) return;
+            seen = generation_;
+        }
+        job_(context_, band, Bands());
+        {
+            lock_guard<mutex> guard(lock_);
+            if (--pending_) continue;
+        }
+        done_.notify_one();
+    }
+}
+
+void BandPool::Run(){
+    const int bands = Bands();
+    if (bands > 1) {
+        {
+            lock_guard<mutex> guard(lock_);
+            pending_ = bands - 1;
+            ++generation_;
+        }
+        begin_.notify_all();
+    }
+    job_(context_, 0, bands);
+    if (bands > 1) {
+        unique_lock<mutex> guard(lock_);
+        done_.wait(guard, [this]{ return pending_ == 0; });
+    }
+}
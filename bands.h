@@ -0,0 +1,40 @@
+#ifndef SFCE_BANDS_H_
+#define SFCE_BANDS_H_
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+using namespace std;
+
+// does band `band` of `bands` of the current job
+typedef void (*BandJob)(void* context, int band, int bands);
+
+// Small pool of threads splitting a job into bands.
+// Run() hands bands 1.. to the workers, does band 0 on the caller and
+// returns when every band is done. The workers sleep between runs, a run
+// takes the lock twice per band and allocates nothing.
+class BandPool
+{
+private:
+    BandJob         job_ = nullptr;
+    void*           context_ = nullptr;
+    vector<thread>  workers_;
+    mutex           lock_;
+    condition_variable begin_;
+    condition_variable done_;
+    uint64_t        generation_ = 0;
+    int             pending_ = 0;
+    bool            closing_ = false;
+
+    void Worker(int band);
+public:
+    ~BandPool();
+    // `threads` including the caller, replaces a running pool
+    void Start(int threads, BandJob job, void* context);
+    void Stop();
+    int Bands() const { return (int)workers_.size() + 1; }
+    void Run();
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "bgcache.h"
+#include <string.h>
+
+void BackgroundCache::DrawTile(const uint8_t* nt, int quadrant, int row, int col){
+    const uint8_t name = nt[row * 32 + col];
+    // 4KB pattern table in 1KB banks
+    const uint8_t* const p0 = patterns_[name >> 6] + (name & 0x3f) * 16;
+    const uint8_t* const p1 = p0 + 8;
+    // 属性表内位偏移
+    const uint8_t attr = nt[32 * 30 + (row >> 2) * 8 + (col >> 2)];
+    const int shift = (col & 2) | ((row & 2) << 1);
+    const uint8_t high = (uint8_t)((attr >> shift & 3) << 2);
+
+    uint8_t* out = &plane_[(quadrant >> 1) * 240 + row * 8][(quadrant & 1) * 256 + col * 8];
+    for (int y = 0; y != 8; ++y, out += PLANE_WIDTH) {
+        const uint8_t low0 = p0[y];
+        const uint8_t low1 = p1[y];
+        for (int x = 0; x != 8; ++x)
+            out[x] = (uint8_t)(high | (low0 >> (7 - x) & 1) | (low1 >> (7 - x) & 1) << 1);
+    }
+    ++tiles_drawn_;
+}
+
+void CaptureRenderInputs(Famicom& fc, RenderInputs& inputs){
+    inputs.source = &fc;
+    inputs.frame = fc.frame_count_;
+    inputs.state_hash = 0;
+    for (int i = 0; i != 8; ++i) inputs.patterns[i] = fc.ppu_.banks[i];
+    for (int quadrant = 0; quadrant != 4; ++quadrant) {
+        const uint8_t* const nt = fc.ppu_.banks[8 + quadrant];
+        inputs.nametable_banks[quadrant] = nt;
+        if (nt) memcpy(inputs.nametables[quadrant], nt, 0x400);
+        int unit = 0;
+        while (unit != VRAM_UNIT_COUNT && fc.vram_units_[unit] != nt) ++unit;
+        // nametables outside VRAM are never written
+        if (unit != VRAM_UNIT_COUNT)
+            memcpy(inputs.dirty_tiles[quadrant], fc.dirty_tiles_[unit], sizeof(inputs.dirty_tiles[quadrant]));
+        else
+            memset(inputs.dirty_tiles[quadrant], 0, sizeof(inputs.dirty_tiles[quadrant]));
+    }
+    // mirrored quadrants share a unit, so clear once all are copied
+    memset(fc.dirty_tiles_, 0, sizeof(fc.dirty_tiles_));
+    memcpy(inputs.sprites, fc.ppu_.sprites, sizeof(inputs.sprites));
+    inputs.raster_start = fc.raster_start_;
+    inputs.palette_lut = fc.palette_lut_;
+    inputs.raster_count = fc.raster_count_;
+    memcpy(inputs.raster, fc.raster_log_, fc.raster_count_ * sizeof(RasterWrite));
+}
+
+void ApplyRaster(const RasterWrite& write, const uint32_t* lut, RasterState& state){
+    switch (write.reg) {
+    case RASTER_CTRL: state.ctrl = write.value; break;
+    case RASTER_MASK:
+        state.mask = write.value;
+        for (int i = 0; i != 0x20; ++i) state.colors[i] = ShownColor(lut, state.spindexes, state.mask, i);
+        break;
+    case RASTER_SCROLL_X: state.scroll[0] = write.value; break;
+    case RASTER_SCROLL_Y: state.scroll[1] = write.value; break;
+    default: {
+        const uint8_t index = write.reg & (uint8_t)0x1f;
+        if (index & 3) {
+            state.spindexes[index] = write.value;
+            state.colors[index] = ShownColor(lut, state.spindexes, state.mask, index);
+            break;
+        }
+        // $3F00/$3F04/$3F08/$3F0C, mirrored at $3F10/$3F14/$3F18/$3F1C
+        state.spindexes[index & 0x0f] = state.spindexes[index | 0x10] = write.value;
+        for (int i = 0; i != 0x20; i += 4) state.colors[i] = ShownColor(lut, state.spindexes, state.mask, i);
+        break;
+    }
+    }
+}
+
+void DrawPlaneLine(const RenderInputs& inputs, int table, unsigned x, unsigned y, uint8_t* indices){
+    x %= PLANE_WIDTH;
+    y %= PLANE_HEIGHT;
+    const unsigned row = y % 240 >> 3;
+    // 33 tiles, the line starts at the fine scroll
+    uint8_t line[33 * 8];
+    for (unsigned tile = 0; tile != 33; ++tile) {
+        const unsigned tx = ((x >> 3) + tile) & 63;
+        const int quadrant = (y >= 240 ? 2 : 0) | (int)(tx >> 5);
+        uint8_t* const out = line + tile * 8;
+        // like the cached plane, a missing nametable is left blank
+        if (!inputs.nametable_banks[quadrant]) {
+            memset(out, 0, 8);
+            continue;
+        }
+        const uint8_t* const nt = inputs.nametables[quadrant];
+        const unsigned col = tx & 31;
+        const uint8_t name = nt[row * 32 + col];
+        const uint8_t* const p0 = inputs.patterns[table + (name >> 6)] + (name & 0x3f) * 16 + (y & 7);
+        const uint8_t attr = nt[32 * 30 + (row >> 2) * 8 + (col >> 2)];
+        const int shift = (col & 2) | ((row & 2) << 1);
+        const uint8_t high = (uint8_t)((attr >> shift & 3) << 2);
+        for (int i = 0; i != 8; ++i)
+            out[i] = (uint8_t)(high | (p0[0] >> (7 - i) & 1) | (p0[8] >> (7 - i) & 1) << 1);
+    }
+    memcpy(indices, line + (x & 7), 256);
+}
+
+void BackgroundCache::Update(const RenderInputs& inputs){
+    bool all = source_ != inputs.source;
+    const uint8_t* const* const patterns = inputs.patterns + BackgroundTable(inputs.raster_start.ctrl);
+    for (int i = 0; i != 4; ++i) {
+        all |= patterns_[i] != patterns[i];
+        patterns_[i] = patterns[i];
+    }
+    source_ = inputs.source;
+
+    for (int quadrant = 0; quadrant != 4; ++quadrant) {
+        const uint8_t* const bank = inputs.nametable_banks[quadrant];
+        const bool switched = all || nametables_[quadrant] != bank;
+        nametables_[quadrant] = bank;
+        if (!bank) continue;
+        const uint8_t* const nt = inputs.nametables[quadrant];
+        for (int row = 0; row != 30; ++row) {
+            const uint32_t dirty = switched ? ~(uint32_t)0 : inputs.dirty_tiles[quadrant][row];
+            if (!dirty) continue;
+            for (int col = 0; col != 32; ++col)
+                if (dirty >> col & 1) DrawTile(nt, quadrant, row, col);
+        }
+    }
+}
+
+void BackgroundCache::Window(unsigned x, unsigned y, unsigned rows, uint8_t* indices) const{
+    x %= PLANE_WIDTH;
+    const unsigned first = PLANE_WIDTH - x < 256 ? PLANE_WIDTH - x : 256;
+    for (unsigned row = 0; row != rows; ++row, indices += 256) {
+        const uint8_t* line = plane_[(y + row) % PLANE_HEIGHT];
+        memcpy(indices, line + x, first);
+        memcpy(indices + first, line, 256 - first);
+    }
+}
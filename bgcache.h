@@ -0,0 +1,77 @@
+#ifndef SFCE_BGCACHE_H_
+#define SFCE_BGCACHE_H_
+#include <cstddef>
+#include <cstdint>
+#include "famicom.h"
+
+// plane of the four nametables
+enum
+{
+    PLANE_WIDTH     = 512,
+    PLANE_HEIGHT    = 480,
+};
+
+// Everything a frame is drawn from, copied out of the machine at the end
+// of the frame so it can be rasterized while the next one runs.
+// CHR is read-only here, so patterns are kept as bank pointers.
+struct RenderInputs
+{
+    const void*     source;             // machine the frame came from
+    uint64_t        frame;
+    uint64_t        state_hash;         // filled in by the caller if wanted
+    const uint8_t*  patterns[8];        // both pattern tables, 1KB banks
+    const uint8_t*  nametable_banks[4]; // identity of each nametable
+    uint8_t         nametables[4][0x400];
+    // tiles written since the previous capture, per nametable
+    uint32_t        dirty_tiles[4][30];
+    uint8_t         sprites[0x100];
+    // registers and palette at the start of the frame, then the writes
+    // made while it was drawn
+    RasterState     raster_start;
+    const uint32_t* palette_lut;        // for colours changed mid-frame
+    RasterWrite     raster[RASTER_LOG_MAX];
+    uint16_t        raster_count;
+};
+
+// fills `inputs` from `fc` and hands the dirty tiles over to it
+void CaptureRenderInputs(Famicom& fc, RenderInputs& inputs);
+// first line a raster write shows on: the horizontal scroll is copied
+// into the PPU at dot 257, the rest is taken at the next line
+inline unsigned RasterLine(const RasterWrite& write){
+    const bool horizontal = write.reg == RASTER_SCROLL_X || write.reg == RASTER_CTRL;
+    return write.scanline + (horizontal && write.dot >= 257 ? 2u : 1u);
+}
+// applies a raster write to `state`, changed colours taken from `lut`
+void ApplyRaster(const RasterWrite& write, const uint32_t* lut, RasterState& state);
+// first 1KB bank in RenderInputs::patterns of the background table `ctrl` selects
+inline int BackgroundTable(uint8_t ctrl){
+    return ctrl & PPU2000_BgTabl ? 4 : 0;
+}
+// one line of 256 palette entries at (x, y) of the plane, drawn straight
+// from the nametables with the pattern table at `table`; for spans that
+// switched away from the table the cached plane was drawn with
+void DrawPlaneLine(const RenderInputs& inputs, int table, unsigned x, unsigned y, uint8_t* indices);
+
+// Pre-rendered background palette entries (0-15) of the whole nametable
+// plane, with the pattern table of the start of the frame. Update() redraws only the tiles written through $2007 since the
+// last update, plus every tile of a nametable or pattern table whose bank
+// was switched, so a static screen costs nothing to redraw.
+class BackgroundCache
+{
+private:
+    const void*     source_ = nullptr;
+    // banks the plane was drawn from: 4 nametables, 4KB of patterns
+    const uint8_t*  nametables_[4] = {};
+    const uint8_t*  patterns_[4] = {};
+    uint64_t        tiles_drawn_ = 0;
+    uint8_t         plane_[PLANE_HEIGHT][PLANE_WIDTH];
+
+    void DrawTile(const uint8_t* nt, int quadrant, int row, int col);
+public:
+    void Update(const RenderInputs& inputs);
+    // `rows` lines of 256 with the top left corner at (x, y), wrapping around
+    void Window(unsigned x, unsigned y, unsigned rows, uint8_t* indices) const;
+    uint64_t TilesDrawn() const { return tiles_drawn_; }
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "cdl.h"
+#include "code.h"
+#include <stdio.h>
+
+void CodeDataLog::Init(size_t prg_size, size_t chr_size){
+    prg_.assign(prg_size, 0);
+    chr_.assign(chr_size, 0);
+}
+
+int CodeDataLog::Load(const string& path){
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return ERROR_FILE_NOT_EXIST;
+    vector<uint8_t> data(prg_.size() + chr_.size() + 1);
+    const size_t size = fread(data.data(), 1, data.size(), file);
+    fclose(file);
+    // a log of another ROM has another size
+    if (size != prg_.size() + chr_.size()) return ERROR_ROM_MISMATCH;
+    for (size_t i = 0; i != prg_.size(); ++i) prg_[i] |= data[i];
+    for (size_t i = 0; i != chr_.size(); ++i) chr_[i] |= data[prg_.size() + i];
+    return 0;
+}
+
+int CodeDataLog::Save(const string& path) const{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return ERROR_FILE_NOT_EXIST;
+    size_t written = fwrite(prg_.data(), 1, prg_.size(), file);
+    written += fwrite(chr_.data(), 1, chr_.size(), file);
+    const int closed = fclose(file);
+    return written == prg_.size() + chr_.size() && !closed ? 0 : ERROR_FILED;
+}
+
+void CodeDataLog::Print(FILE* out) const{
+    size_t code = 0, opcodes = 0, data = 0, both = 0;
+    for (size_t i = 0; i != prg_.size(); ++i) {
+        const uint8_t f = prg_[i];
+        code += (f & CDL_CODE) != 0;
+        opcodes += (f & CDL_OPCODE) != 0;
+        data += (f & CDL_DATA) != 0;
+        both += (f & (CDL_CODE | CDL_DATA)) != 0;
+    }
+    size_t drawn = 0, read = 0;
+    for (size_t i = 0; i < chr_.size(); i += 16) {
+        uint8_t f = 0;
+        for (size_t j = i; j != i + 16 && j < chr_.size(); ++j) f |= chr_[j];
+        drawn += (f & CDL_DRAWN) != 0;
+        read += (f & CDL_READ) != 0;
+    }
+    const double prg = prg_.empty() ? 1.0 : (double)prg_.size();
+    const size_t tiles = (chr_.size() + 15) / 16;
+    fprintf(out,
+        "CDL PRG: %zu bytes, code %zu (%.1f%%, %zu instructions), data %zu (%.1f%%), "
+        "unlogged %zu (%.1f%%)\n",
+        prg_.size(), code, 100.0 * code / prg, opcodes, data, 100.0 * data / prg,
+        prg_.size() - both, 100.0 * (prg_.size() - both) / prg);
+    fprintf(out, "CDL CHR: %zu tiles, drawn %zu, read %zu\n", tiles, drawn, read);
+}
@@ -0,0 +1,59 @@
+#ifndef SFCE_CDL_H_
+#define SFCE_CDL_H_
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+using namespace std;
+
+// PRG flags, FCEUX .cdl layout
+enum
+{
+    CDL_CODE        = 0x01, // 作为代码执行(操作码或操作数)
+    CDL_DATA        = 0x02, // 作为数据读取
+    CDL_BANK_MASK   = 0x0C, // 映射到的8KB窗口 ($8000=0 .. $E000=3)
+    CDL_BANK_SHIFT  = 2,
+    CDL_OPCODE      = 0x80, // 指令首字节, bit 7 is unused by FCEUX
+};
+
+// CHR flags
+enum
+{
+    CDL_DRAWN       = 0x01, // 被渲染
+    CDL_READ        = 0x02, // 通过$2007读取
+};
+
+// Code/Data Logger: one flag byte per PRG byte followed by one per CHR
+// byte, the file is exactly that (same as FCEUX's .cdl).
+class CodeDataLog
+{
+private:
+    vector<uint8_t> prg_;
+    vector<uint8_t> chr_;
+public:
+    void Init(size_t prg_size, size_t chr_size);
+    // merges flags from an existing log of the same ROM
+    int Load(const string& path);
+    int Save(const string& path) const;
+
+    void Code(size_t offset, uint8_t bank, int size){
+        prg_[offset] |= (uint8_t)(CDL_CODE | CDL_OPCODE | (bank << CDL_BANK_SHIFT));
+        for (int i = 1; i < size && offset + i < prg_.size(); ++i)
+            prg_[offset + i] |= (uint8_t)(CDL_CODE | (bank << CDL_BANK_SHIFT));
+    }
+    void Data(size_t offset, uint8_t bank){
+        prg_[offset] |= (uint8_t)(CDL_DATA | (bank << CDL_BANK_SHIFT));
+    }
+    // one 16-byte tile
+    void Tile(size_t offset, uint8_t flag){
+        for (int i = 0; i != 16 && offset + i < chr_.size(); ++i) chr_[offset + i] |= flag;
+    }
+    void Chr(size_t offset, uint8_t flag){
+        if (offset < chr_.size()) chr_[offset] |= flag;
+    }
+    // coverage summary for reports
+    void Print(FILE* out) const;
+};
+
+#endif
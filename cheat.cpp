@@ -0,0 +1,113 @@
+#include "cheat.h"
+#include "code.h"
+#include <string.h>
+#include <stdlib.h>
+
+static int GenieDigit(char c){
+    static const char letters[] = "APZLGITYEOXUKSVN";
+    // anything but a letter would fold onto '\0' or punctuation
+    if ((c < 'A' || c > 'Z') && (c < 'a' || c > 'z')) return -1;
+    const char* p = strchr(letters, c & ~0x20);
+    return p ? (int)(p - letters) : -1;
+}
+
+static int ParseGenie(const string& code, Cheat& cheat){
+    int n[8];
+    for (size_t i = 0; i != code.size(); ++i) {
+        n[i] = GenieDigit(code[i]);
+        if (n[i] < 0) return ERROR_ILLEGAL_CODE;
+    }
+    cheat.address = (uint16_t)(0x8000
+        | ((n[3] & 7) << 12)
+        | ((n[5] & 7) << 8) | ((n[4] & 8) << 8)
+        | ((n[2] & 7) << 4) | ((n[1] & 8) << 4)
+        | (n[4] & 7) | (n[3] & 8));
+    cheat.value = (uint8_t)(((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7));
+    cheat.kind = CHEAT_ROM;
+    if (code.size() == 6) {
+        cheat.value |= (uint8_t)(n[5] & 8);
+        cheat.compare = 0;
+        cheat.has_compare = 0;
+    }
+    else {
+        cheat.value |= (uint8_t)(n[7] & 8);
+        cheat.compare = (uint8_t)(((n[7] & 7) << 4) | ((n[6] & 8) << 4) | (n[6] & 7) | (n[5] & 8));
+        cheat.has_compare = 1;
+    }
+    return 0;
+}
+
+static bool ParseHex(const string& text, unsigned max, unsigned& out){
+    if (text.empty() || text.size() > 4) return false;
+    char* end = nullptr;
+    const unsigned long v = strtoul(text.c_str(), &end, 16);
+    if (*end || v > max) return false;
+    out = (unsigned)v;
+    return true;
+}
+
+int ParseCheat(const string& code, Cheat& cheat){
+    const size_t colon = code.find(':');
+    if (colon == string::npos) {
+        if (code.size() != 6 && code.size() != 8) return ERROR_ILLEGAL_CODE;
+        return ParseGenie(code, cheat);
+    }
+    // AAAA[?CC]:VV
+    const size_t question = code.find('?');
+    const size_t address_end = question < colon ? question : colon;
+    unsigned address, value, compare = 0;
+    if (!ParseHex(code.substr(0, address_end), 0xffff, address)) return ERROR_ILLEGAL_CODE;
+    if (!ParseHex(code.substr(colon + 1), 0xff, value)) return ERROR_ILLEGAL_CODE;
+    if (question < colon
+        && !ParseHex(code.substr(question + 1, colon - question - 1), 0xff, compare))
+        return ERROR_ILLEGAL_CODE;
+    cheat.address = (uint16_t)address;
+    cheat.value = (uint8_t)value;
+    cheat.compare = (uint8_t)compare;
+    cheat.has_compare = question < colon;
+    cheat.kind = address >= 0x8000 ? CHEAT_ROM : CHEAT_RAM;
+    // only ROM patches can be conditional, RAM is rewritten every frame
+    if (cheat.kind == CHEAT_RAM && cheat.has_compare) return ERROR_ILLEGAL_CODE;
+    return 0;
+}
+
+CheatEngine::CheatEngine(){
+    Clear();
+}
+
+int CheatEngine::Add(const string& code){
+    Cheat cheat;
+    const int result = ParseCheat(code, cheat);
+    if (result) return result;
+    cheats_.push_back(cheat);
+    if (cheat.kind == CHEAT_ROM) {
+        ++per_page_[cheat.address >> 8];
+        if (copies_.empty()) copies_.resize(0x80 * 0x100);
+    }
+    return 0;
+}
+
+void CheatEngine::Clear(){
+    cheats_.clear();
+    memset(per_page_, 0, sizeof(per_page_));
+}
+
+void CheatEngine::Overlay(uint8_t* const* page_map, const uint8_t** read_map, int first, int count){
+    for (int page = first; page != first + count; ++page) {
+        read_map[page] = page_map[page];
+        if (!per_page_[page] || !page_map[page]) continue;
+        uint8_t* const copy = copies_.data() + ((page - 0x80) << 8);
+        memcpy(copy, page_map[page], 0x100);
+        bool patched = false;
+        for (size_t i = 0; i != cheats_.size(); ++i) {
+            const Cheat& cheat = cheats_[i];
+            if (cheat.kind != CHEAT_ROM || (cheat.address >> 8) != page) continue;
+            uint8_t& data = copy[cheat.address & 0xff];
+            if (cheat.has_compare && page_map[page][cheat.address & 0xff] != cheat.compare) continue;
+            data = cheat.value;
+            patched = true;
+        }
+        // a compare miss leaves the page on the fast direct mapping
+        if (patched) read_map[page] = copy;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef SFCE_CHEAT_H_
+#define SFCE_CHEAT_H_
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std;
+
+// cheat kind
+enum
+{
+    CHEAT_ROM = 0,  // ROM补丁, 通过替换256字节页实现
+    CHEAT_RAM,      // RAM冻结, 每帧写入一次
+};
+
+struct Cheat
+{
+    uint16_t address;
+    uint8_t  value;
+    uint8_t  compare;
+    uint8_t  has_compare;
+    uint8_t  kind;
+};
+
+// Parses "XXXXXX" / "XXXXXXXX" Game Genie codes and raw "AAAA:VV" or
+// "AAAA?CC:VV" codes. Raw codes below $8000 freeze RAM/SRAM.
+int ParseCheat(const string& code, Cheat& cheat);
+
+// Cheats never touch the read path: a ROM page with an active patch is
+// swapped in the cpu read map for a private patched copy, every other
+// page keeps pointing straight at its bank.
+class CheatEngine
+{
+private:
+    vector<Cheat>   cheats_;
+    // patch count per cpu page, lets Overlay skip clean pages
+    uint16_t        per_page_[256];
+    // patched copies of pages $80-$FF
+    vector<uint8_t> copies_;
+public:
+    CheatEngine();
+    int Add(const string& code);
+    void Clear();
+    bool Empty() const { return cheats_.empty(); }
+    size_t Count() const { return cheats_.size(); }
+    // rebuild read_map entries [first, first + count) from page_map,
+    // compare values are checked against the bytes mapped right now
+    void Overlay(uint8_t* const* page_map, const uint8_t** read_map, int first, int count);
+    // write RAM freeze values, once per frame, into writable(cpu page)
+    template<typename Writable> void Freeze(Writable writable) const{
+        for (size_t i = 0; i != cheats_.size(); ++i) {
+            const Cheat& cheat = cheats_[i];
+            if (cheat.kind != CHEAT_RAM) continue;
+            uint8_t* const page = writable(cheat.address >> 8);
+            if (page) page[cheat.address & 0xff] = cheat.value;
+        }
+    }
+};
+
+#endif
@@ -10,7 +10,10 @@ enum
     ERROR_FILED,
     ERROR_FILE_NOT_EXIST,
     ERROR_ILLEGAL_FILE,
-    ERROR_OUT_OF_MEMORY
+    ERROR_OUT_OF_MEMORY,
+    ERROR_ROM_MISMATCH,
+    ERROR_UNSUPPORTED,
+    ERROR_ILLEGAL_CODE
 };
 
 /* ROM control byte #1 */
@@ -339,4 +342,31 @@ static const OpName OPNAMEDATA[256] = {
     { 'S', 'B', 'C', AM_ABX },
     { 'I', 'N', 'C', AM_ABX },
     { 'I', 'S', 'B', AM_ABX },
-};
\ No newline at end of file
+};
+
+/* 6502 cycle table, CYCLE_PAGE: +1 cycle when indexing crosses a page */
+enum
+{
+    CYCLE_PAGE = 0x80,
+    CYCLE_MASK = 0x7f
+};
+#define P_ | CYCLE_PAGE
+static const uint8_t CYCLEDATA[256] = {
+    7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,
+    2, 5 P_, 2, 8, 4, 4, 6, 6, 2, 4 P_, 2, 7, 4 P_, 4 P_, 7, 7,
+    6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,
+    2, 5 P_, 2, 8, 4, 4, 6, 6, 2, 4 P_, 2, 7, 4 P_, 4 P_, 7, 7,
+    6, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6,
+    2, 5 P_, 2, 8, 4, 4, 6, 6, 2, 4 P_, 2, 7, 4 P_, 4 P_, 7, 7,
+    6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6,
+    2, 5 P_, 2, 8, 4, 4, 6, 6, 2, 4 P_, 2, 7, 4 P_, 4 P_, 7, 7,
+    2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,
+    2, 6, 2, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5,
+    2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,
+    2, 5 P_, 2, 5 P_, 4, 4, 4, 4, 2, 4 P_, 2, 4 P_, 4 P_, 4 P_, 4 P_, 4 P_,
+    2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,
+    2, 5 P_, 2, 8, 4, 4, 6, 6, 2, 4 P_, 2, 7, 4 P_, 4 P_, 7, 7,
+    2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,
+    2, 5 P_, 2, 8, 4, 4, 6, 6, 2, 4 P_, 2, 7, 4 P_, 4 P_, 7, 7,
+};
+#undef P_
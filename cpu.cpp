@@ -1,10 +1,21 @@
 #include "cpu.h"
+#include "diff.h"
+#include <assert.h>
 
 
 
 Cpu::Cpu(){}
 Cpu::Cpu(Famicom& fa){
     famicom_ = &fa;
+    hot_ = &fa.state_;
+}
+
+void Cpu::Writeback(){
+    if (hot_ != &famicom_->state_) famicom_->state_ = *hot_;
+}
+
+void Cpu::Refresh(){
+    hot_->deadline = famicom_->state_.deadline;
 }
 
 uint8_t Cpu::Read(uint16_t address){
@@ -25,22 +36,45 @@ uint8_t Cpu::Read(uint16_t address){
     | $C000   | $4000 |       | PRG-ROM               |
     +---------+-------+-------+-----------------------+
     */
+    // RAM, SRAM and PRG-ROM pages are read straight from the map
+    const uint8_t* page = famicom_->read_map_[address >> 8];
+    if (page) return page[address & (uint16_t)0xff];
+    // I/O, or a page with a watchpoint on it
+    if (debugger_) debugger_->Access(address, 0, false);
+    const uint8_t data = ReadUnmapped(address);
+    if (diff_) diff_->OnRead(address, data);
+    return data;
+}
+
+uint8_t Cpu::ReadUnmapped(uint16_t address){
+    const uint8_t* page = famicom_->direct_map_[address >> 8];
+    if (page) return page[address & (uint16_t)0xff];
     switch(address >> 13){
     case 0:
         // [$0000,$2000) RAM
-        return famicom_->main_memory_[address & (uint16_t)0x07ff];
+        return famicom_->ram_pages_[(address >> 8) & 0x07][address & (uint16_t)0xff];
     case 1:
+    {
         // [$2000,$4000) not suported yet
-        return ReadPPU(address);
-        return 0;
+        Writeback();
+        const uint8_t data = ReadPPU(address);
+        Refresh();
+        return data;
+    }
     case 2:
+    {
         // [$4000,$6000) not suported yet
-        if (address < 0x4020) return Read4020(address);
+        uint8_t data = 0;
+        Writeback();
+        if (address < 0x4020) data = Read4020(address);
         else assert(!"NOT IMPL");
-        return 0;
+        Refresh();
+        return data;
+    }
     case 3:
         // [$6000,$8000) SRAM
-        return famicom_->save_memory_[address & (uint16_t)0x1fff];
+        if (!famicom_->save_memory_) return 0;
+        return famicom_->ram_pages_[8 + ((address >> 8) & 0x1f)][address & (uint16_t)0xff];
     case 4: case 5: case 6: case 7:
         // [$8000,$10000) PRG-ROM
         return famicom_->prg_banks_[address >> 13][address & (uint16_t)0x1fff];
@@ -51,28 +85,44 @@ uint8_t Cpu::Read(uint16_t address){
 
 }
 void Cpu::Write(uint16_t address, uint8_t data){
+    uint8_t* page = famicom_->write_map_[address >> 8];
+    if (page) {
+        page[address & (uint16_t)0xff] = data;
+        return;
+    }
+    if (debugger_) debugger_->Access(address, data, true);
+    if (diff_) diff_->OnWrite(address, data);
+    // the harness' sandbox is writable everywhere
+    if (famicom_->flat_) {
+        famicom_->flat_[address] = data;
+        return;
+    }
     switch(address >> 13){
     case 0:
-        // [$0000,$2000) RAM
-        famicom_->main_memory_[address & (uint16_t)0x07ff] = data;
+    case 3:
+    {
+        // [$0000,$2000) RAM, [$6000,$8000) SRAM, maybe still shared by a fork
+        uint8_t* page = famicom_->WritableRamPage(address >> 8);
+        if (page) page[address & (uint16_t)0xff] = data;
         return;
+    }
     case 1:
         // [$2000,$4000) not suported yet
+        Writeback();
         WritePPU(address, data);
+        Refresh();
         return;
     case 2:
         // [$4000,$6000) not suported yet
+        Writeback();
         if (address < 0x4020) Write4020(address, data);
         else assert(!"NOT IMPL");
-        return;
-    case 3:
-        // [$6000,$8000) SRAM
-        famicom_->save_memory_[address & (uint16_t)0x1fff] = data;
+        Refresh();
         return;
     case 4: case 5: case 6: case 7:
         // [$8000,$10000) PRG-ROM
+        // the ROM may be shared with other instances, never written
         assert(!"WARNING: PRG-ROM");
-        famicom_->prg_banks_[address >> 13][address & (uint16_t)0x1fff] = data;
         return;
     default:
         assert(!"invalid address");
@@ -80,6 +130,8 @@ void Cpu::Write(uint16_t address, uint8_t data){
 }
 
 uint8_t Cpu::ReadPPU(uint16_t address){
+    // registers are the only window into the PPU, catch it up first
+    famicom_->SyncPPU();
     uint8_t data = 0x00;
     PPU* ppu = &famicom_->ppu_;
     switch (address & (uint16_t)0x7){
@@ -119,16 +171,30 @@ uint8_t Cpu::ReadPPU(uint16_t address){
     return data;
 }
 void Cpu::WritePPU(uint16_t address, uint8_t data){
+    famicom_->SyncPPU();
     PPU* ppu = &famicom_->ppu_;
     switch (address & (uint16_t)0x7){
     // address last 3 bits
     case 0:
         // 0x2000: Controller ($2000) > write only
+        if ((ppu->ctrl ^ data) & (uint8_t)PPU2000_NMIGen) {
+            ppu->ctrl = data;
+            famicom_->ScheduleNMI();
+            // enabling NMI during VBlank raises it immediately
+            if ((data & (uint8_t)PPU2000_NMIGen) && (ppu->status & (uint8_t)PPU2002_VBlank))
+                famicom_->Schedule(EVENT_NMI, famicom_->state_.cycle);
+        }
         ppu->ctrl = data;
+        famicom_->LogRaster(RASTER_CTRL, data);
         break;
     case 1:
         // 0x2001: Mask ($2001) > write only
+        if ((ppu->mask ^ data) & (uint8_t)(PPU2001_Grey | PPU2001_Emphasis)) {
+            ppu->mask = data;
+            famicom_->UpdateColors();
+        }
         ppu->mask = data;
+        famicom_->LogRaster(RASTER_MASK, data);
         break;
     case 2:
         // 0x2002: Status ($2002) < read only
@@ -141,10 +207,12 @@ void Cpu::WritePPU(uint16_t address, uint8_t data){
     case 4:
         // 0x2004: OAM data ($2004) <> read/write
         ppu->sprites[ppu->oamaddr++] = data;
+        famicom_->dirty_ |= (uint64_t)1 << DIRTY_OAM;
         break;
     case 5:
         // 0x2005: Scroll ($2005) >> write x2
         ppu->scroll[ppu->writex2 & 1] = data;
+        famicom_->LogRaster((uint8_t)(RASTER_SCROLL_X + (ppu->writex2 & 1)), data);
         ++ppu->writex2;
         break;
     case 6:
@@ -180,12 +248,29 @@ uint8_t Cpu::Read4020(uint16_t address){
         data = (famicom_->controller_states_+8)[famicom_->controller2_ & famicom_->controller_status_mask_];
         ++famicom_->controller2_;
         break;
+    case 0x15:
+        // APU status, reading acknowledges the frame IRQ
+        if (famicom_->irq_lines_ & (uint8_t)IRQ_APU_FRAME) data |= 0x40;
+        famicom_->irq_lines_ &= ~(uint8_t)IRQ_APU_FRAME;
+        break;
     }
     return data;
 }
 void Cpu::Write4020(uint16_t address, uint8_t data){
     switch (address & (uint16_t)0x1f)
     {
+    case 0x14:
+        // OAM DMA, performed by the scheduler after this instruction
+        famicom_->dma_page_ = data;
+        famicom_->Schedule(EVENT_DMA, famicom_->state_.cycle);
+        break;
+    case 0x17:
+        // APU frame counter: 4-step mode without inhibit raises frame IRQ
+        if (data & 0x40) famicom_->irq_lines_ &= ~(uint8_t)IRQ_APU_FRAME;
+        if (data & 0xC0) famicom_->scheduler_.Cancel(EVENT_APU_FRAME_IRQ);
+        else famicom_->Schedule(EVENT_APU_FRAME_IRQ,
+            famicom_->state_.cycle + (uint64_t)APU_FRAME_PERIOD * MASTER_PER_CPU);
+        break;
     case 0x16:
         famicom_->controller_status_mask_ = (data & 1) ? 0x0 : 0x7;
         if (data & 1) {
@@ -197,129 +282,15 @@ void Cpu::Write4020(uint16_t address, uint8_t data){
 }
 
 
-#define fallthrough
-std::string Cpu::Disassembly(uint16_t address){
-    string res = "$";
-    res += btoh((uint8_t)(address >> 8));
-    res += btoh((uint8_t)(address));
-    res += "     ";
-
-    Code6502 code;
-    code.data = 0;
-
-
-
-    code.op = Read(address);
-    code.a1 = Read(address + 1);
-    code.a2 = Read(address + 2);
-    const struct OpName opname = OPNAMEDATA[code.op];
-    string o(3,' ');
-    o[0] = opname.name[0];
-    o[1] = opname.name[1];
-    o[2] = opname.name[2];
-    res += o;
-    res += "    ";
-
-
-
-    switch (opname.mode)
-    {
-    case AM_UNK:
-        fallthrough;
-    case AM_IMP:
-        // XXX     ;
-        break;
-    case AM_ACC:
-        // XXX A   ;
-        res += "A";
-        break;
-    case AM_IMM:
-        // XXX #$AB
-        res += "#$";
-        res += btoh(code.a1);
-        break;
-    case AM_ABS:
-        // XXX $ABCD
-        fallthrough;
-    case AM_ABX:
-        // XXX $ABCD, X
-        fallthrough;
-    case AM_ABY:
-        // XXX $ABCD, Y
-        // REAL
-        res += "$";
-        res += btoh(code.a2);
-        res += btoh(code.a1);
-        if (opname.mode == AM_ABS) break;
-        res += ",";
-        res += opname.mode == AM_ABX ? "X" : "Y";
-        break;
-    case AM_ZPG:
-        // XXX $AB
-        fallthrough;
-    case AM_ZPX:
-        // XXX $AB, X
-        fallthrough;
-    case AM_ZPY:
-        // XXX $AB, Y
-        // REAL
-        res += "$";
-        res += btoh(code.a1);
-        if (opname.mode == AM_ZPG) break;
-        res += ",";
-        res += opname.mode == AM_ABX ? "X" : "Y";
-        break;
-    case AM_INX:
-        // XXX ($AB, X)
-        res += "($";
-        res += btoh(code.a1);
-        res += ",X)";
-        break;
-    case AM_INY:
-        // XXX ($AB), Y
-        res += "($";
-        res += btoh(code.a1);
-        res += ",Y)";
-        break;
-    case AM_IND:
-        // XXX ($ABCD)
-        res += "($";
-        res += btoh(code.a2);
-        res += btoh(code.a1);
-        res += ")";
-        break;
-    case AM_REL:
-        // XXX $AB(-085)
-        // XXX $ABCD
-        res += "$a";
-        res += btoh(code.a1);
-        res += "(";
-        res += btod(code.a1);
-        res += ")";
-        break;
-    }
-    while(res.size() < 32) res += " ";
-    return res;
-}
-string Cpu::btoh(uint8_t b) {
-    string o(2,' ');
-    o[0] = HEXDATA[b >> 4];
-    o[1] = HEXDATA[b & (uint8_t)0x0F];
-    return o;
+uint8_t Cpu::Peek(uint16_t address){
+    const uint8_t* page = famicom_->direct_map_[address >> 8];
+    return page ? page[address & (uint16_t)0xff] : 0;
 }
 
-string Cpu::btod(uint8_t b) {
-    string o(4,' ');
-    const int8_t sb = (int8_t)b;
-    if (sb < 0) {
-        o[0] = '-';
-        b = -b;
-    }
-    else o[0] = '+';
-    o[1] = HEXDATA[(uint8_t)b / 100];
-    o[2] = HEXDATA[(uint8_t)b / 10 % 10];
-    o[3] = HEXDATA[(uint8_t)b % 10];
-    return o;
+void Cpu::Disassembly(uint16_t address, char* buf){
+    DisasmLine line;
+    DecodeInstruction(address, Peek(address), Peek(address + 1), Peek(address + 2), line);
+    FormatInstruction(line, buf);
 }
 
 // 宏定义
@@ -327,10 +298,241 @@ string Cpu::btod(uint8_t b) {
 // registers
 
 
+// every opcode ExecuteOne decodes, with its addressing and operation;
+// the reference core and the random sandbox go by the same list
+#define CPU_OPCODES(X) \
+    X(4C, ABS, JMP) \
+    X(A2, IMM, LDX) \
+    X(86, ZPG, STX) \
+    X(20, ABS, JSR) \
+    X(EA, IMP, NOP) \
+    X(38, IMP, SEC) \
+    X(B0, REL, BSC) \
+    X(18, IMP, CLC) \
+    X(58, IMP, CLI) \
+    X(90, REL, BCC) \
+    X(A9, IMM, LDA) \
+    X(F0, REL, BEQ) \
+    X(D0, REL, BNE) \
+    X(85, ZPG, STA) \
+    X(24, ZPG, BIT) \
+    X(70, REL, BVS) \
+    X(50, REL, BVC) \
+    X(10, REL, BPL) \
+    X(1A, IMP, NOP) \
+    X(3A, IMP, NOP) \
+    X(5A, IMP, NOP) \
+    X(7A, IMP, NOP) \
+    X(DA, IMP, NOP) \
+    X(FA, IMP, NOP) \
+    X(60, IMP, RTS) \
+    X(78, IMP, SEI) \
+    X(F8, IMP, SED) \
+    X(08, IMP, PHP) \
+    X(68, IMP, PLA) \
+    X(80, IMM, NOP) \
+    X(29, IMM, AND) \
+    X(C9, IMM, CMP) \
+    X(D8, IMP, CLD) \
+    X(48, IMP, PHA) \
+    X(28, IMP, PLP) \
+    X(30, REL, BMI) \
+    X(09, IMM, ORA) \
+    X(B8, IMP, CLV) \
+    X(49, IMM, EOR) \
+    X(69, IMM, ADC) \
+    X(A0, IMM, LDY) \
+    X(C0, IMM, CPY) \
+    X(E0, IMM, CPX) \
+    X(E9, IMM, SBC) \
+    X(C8, IMP, INY) \
+    X(E8, IMP, INX) \
+    X(88, IMP, DEY) \
+    X(CA, IMP, DEX) \
+    X(A8, IMP, TAY) \
+    X(AA, IMP, TAX) \
+    X(98, IMP, TYA) \
+    X(8A, IMP, TXA) \
+    X(BA, IMP, TSX) \
+    X(8E, ABS, STX) \
+    X(9A, IMP, TXS) \
+    X(AE, ABS, LDX) \
+    X(AD, ABS, LDA) \
+    X(40, IMP, RTI) \
+    X(4A, ACC, LSRA) \
+    X(0A, ACC, ASLA) \
+    X(6A, ACC, RORA) \
+    X(2A, ACC, ROLA) \
+    X(A5, ZPG, LDA) \
+    X(8D, ABS, STA) \
+    X(A1, INX, LDA) \
+    X(A3, INX, LAX) \
+    X(81, INX, STA) \
+    X(01, INX, ORA) \
+    X(21, INX, AND) \
+    X(41, INX, EOR) \
+    X(61, INX, ADC) \
+    X(C1, INX, CMP) \
+    X(E1, INX, SBC) \
+    X(04, ZPG, NOP) \
+    X(44, ZPG, NOP) \
+    X(64, ZPG, NOP) \
+    X(A4, ZPG, LDY) \
+    X(84, ZPG, STY) \
+    X(A6, ZPG, LDX) \
+    X(A7, ZPG, LAX) \
+    X(05, ZPG, ORA) \
+    X(25, ZPG, AND) \
+    X(45, ZPG, EOR) \
+    X(65, ZPG, ADC) \
+    X(C5, ZPG, CMP) \
+    X(E5, ZPG, SBC) \
+    X(E4, ZPG, CPX) \
+    X(C4, ZPG, CPY) \
+    X(46, ZPG, LSR) \
+    X(06, ZPG, ASL) \
+    X(66, ZPG, ROR) \
+    X(26, ZPG, ROL) \
+    X(E6, ZPG, INC) \
+    X(C6, ZPG, DEC) \
+    X(0C, ABS, NOP) \
+    X(AC, ABS, LDY) \
+    X(8C, ABS, STY) \
+    X(2C, ABS, BIT) \
+    X(0D, ABS, ORA) \
+    X(2D, ABS, AND) \
+    X(4D, ABS, EOR) \
+    X(6D, ABS, ADC) \
+    X(CD, ABS, CMP) \
+    X(ED, ABS, SBC) \
+    X(EC, ABS, CPX) \
+    X(CC, ABS, CPY) \
+    X(4E, ABS, LSR) \
+    X(0E, ABS, ASL) \
+    X(6E, ABS, ROR) \
+    X(2E, ABS, ROL) \
+    X(EE, ABS, INC) \
+    X(CE, ABS, DEC) \
+    X(AF, ABS, LAX) \
+    X(B1, INY, LDA) \
+    X(11, INY, ORA) \
+    X(31, INY, AND) \
+    X(51, INY, EOR) \
+    X(71, INY, ADC) \
+    X(D1, INY, CMP) \
+    X(F1, INY, SBC) \
+    X(91, INY, STA) \
+    X(B3, INY, LAX) \
+    X(6C, IND, JMP) \
+    X(14, ZPX, NOP) \
+    X(15, ZPX, ORA) \
+    X(16, ZPX, ASL) \
+    X(34, ZPX, NOP) \
+    X(35, ZPX, AND) \
+    X(36, ZPX, ROL) \
+    X(54, ZPX, NOP) \
+    X(55, ZPX, EOR) \
+    X(56, ZPX, LSR) \
+    X(74, ZPX, NOP) \
+    X(75, ZPX, ADC) \
+    X(76, ZPX, ROR) \
+    X(94, ZPX, STY) \
+    X(95, ZPX, STA) \
+    X(B4, ZPX, LDY) \
+    X(B5, ZPX, LDA) \
+    X(D4, ZPX, NOP) \
+    X(D5, ZPX, CMP) \
+    X(D6, ZPX, DEC) \
+    X(F4, ZPX, NOP) \
+    X(F5, ZPX, SBC) \
+    X(F6, ZPX, INC) \
+    X(B6, ZPY, LDX) \
+    X(96, ZPY, STX) \
+    X(1C, ABX, NOP) \
+    X(1D, ABX, ORA) \
+    X(1E, ABX, ASL) \
+    X(3C, ABX, NOP) \
+    X(3D, ABX, AND) \
+    X(3E, ABX, ROL) \
+    X(5C, ABX, NOP) \
+    X(5D, ABX, EOR) \
+    X(5E, ABX, LSR) \
+    X(7C, ABX, NOP) \
+    X(7D, ABX, ADC) \
+    X(7E, ABX, ROR) \
+    X(9D, ABX, STA) \
+    X(BC, ABX, LDY) \
+    X(BD, ABX, LDA) \
+    X(DC, ABX, NOP) \
+    X(DD, ABX, CMP) \
+    X(DE, ABX, DEC) \
+    X(FC, ABX, NOP) \
+    X(FD, ABX, SBC) \
+    X(FE, ABX, INC) \
+    X(19, ABY, ORA) \
+    X(39, ABY, AND) \
+    X(59, ABY, EOR) \
+    X(79, ABY, ADC) \
+    X(99, ABY, STA) \
+    X(B9, ABY, LDA) \
+    X(BE, ABY, LDX) \
+    X(D9, ABY, CMP) \
+    X(F9, ABY, SBC) \
+    X(B7, ZPY, LAX) \
+    X(BF, ABY, LAX) \
+    X(83, INX, SAX) \
+    X(87, ZPG, SAX) \
+    X(8F, ABS, SAX) \
+    X(97, ZPY, SAX) \
+    X(EB, IMM, SBC) \
+    X(C3, INX, DCP) \
+    X(C7, ZPG, DCP) \
+    X(CF, ABS, DCP) \
+    X(D3, INY, DCP) \
+    X(D7, ZPX, DCP) \
+    X(DB, ABY, DCP) \
+    X(DF, ABX, DCP) \
+    X(E3, INX, ISB) \
+    X(E7, ZPG, ISB) \
+    X(EF, ABS, ISB) \
+    X(F3, INY, ISB) \
+    X(F7, ZPX, ISB) \
+    X(FB, ABY, ISB) \
+    X(FF, ABX, ISB) \
+    X(03, INX, SLO) \
+    X(07, ZPG, SLO) \
+    X(0F, ABS, SLO) \
+    X(13, INY, SLO) \
+    X(17, ZPX, SLO) \
+    X(1B, ABY, SLO) \
+    X(1F, ABX, SLO) \
+    X(23, INX, RLA) \
+    X(27, ZPG, RLA) \
+    X(2F, ABS, RLA) \
+    X(33, INY, RLA) \
+    X(37, ZPX, RLA) \
+    X(3B, ABY, RLA) \
+    X(3F, ABX, RLA) \
+    X(43, INX, SRE) \
+    X(47, ZPG, SRE) \
+    X(4F, ABS, SRE) \
+    X(53, INY, SRE) \
+    X(57, ZPX, SRE) \
+    X(5B, ABY, SRE) \
+    X(5F, ABX, SRE) \
+    X(63, INX, RRA) \
+    X(67, ZPG, RRA) \
+    X(6F, ABS, RRA) \
+    X(73, INY, RRA) \
+    X(77, ZPX, RRA) \
+    X(7B, ABY, RRA) \
+    X(7F, ABX, RRA)
+
 #define OP(n, a, o) \
 case 0x##n:\
 {           \
     const uint16_t address = addressing.a();\
+    if (kMode & RUN_CDL) LogData(opcode, address);\
     operation.o(address);\
     break;\
 }
@@ -338,260 +540,113 @@ case 0x##n:\
 void Cpu::Log(){
     static int line = 0;
     line++;
-    const uint16_t pc = famicom_->registers_.programCounter;
+    const uint16_t pc = REG_PC;
 
-    auto buf = Disassembly(pc);
+    char buf[DISASM_LINE_SIZE];
+    Disassembly(pc, buf);
 
-    
     printf(
         "%4d - %s   A:%02X X:%02X Y:%02X P:%02X SP:%02X\n",
-        line, buf.c_str(),
-        (int)famicom_->registers_.accumulator,
-        (int)famicom_->registers_.xIndex,
-        (int)famicom_->registers_.yIndex,
-        (int)famicom_->registers_.status,
-        (int)famicom_->registers_.stackPointer
+        line, buf,
+        (int)REG_A,
+        (int)REG_X,
+        (int)REG_Y,
+        (int)REG.Status(),
+        (int)REG_SP
     );
 }
 
 
 
-void Cpu::ExecuteOne(){
-    Log();
+void Cpu::LogCode(uint16_t pc, uint8_t opcode){
+    size_t offset;
+    if (famicom_->PrgOffset(pc, offset))
+        famicom_->cdl_->Code(offset, (uint8_t)((pc >> 13) & 3), InstructionSize(OPNAMEDATA[opcode].mode));
+}
+
+void Cpu::LogData(uint8_t opcode, uint16_t address){
+    // only modes with a memory operand, JMP/JSR only take the address
+    switch (OPNAMEDATA[opcode].mode) {
+    case AM_ABS: case AM_ABX: case AM_ABY:
+    case AM_ZPG: case AM_ZPX: case AM_ZPY:
+    case AM_INX: case AM_INY:
+        break;
+    default:
+        return;
+    }
+    if (opcode == 0x4C || opcode == 0x20) return;
+    size_t offset;
+    if (famicom_->PrgOffset(address, offset))
+        famicom_->cdl_->Data(offset, (uint8_t)((address >> 13) & 3));
+}
+
+#define DECODES(n, a, o) case 0x##n:
+bool Cpu::Decodes(uint8_t opcode){
+    switch (opcode) {
+        CPU_OPCODES(DECODES)
+        return true;
+    }
+    return false;
+}
+#undef DECODES
+
+template<int kMode>
+void Cpu::ExecuteOne(Addressing& addressing, Operation& operation){
+    if (kMode & RUN_DEBUG) {
+        if (debugger_ && debugger_->Check(*hot_)) debugger_->Prompt(*hot_);
+        if (trace_) Log();
+    }
+    if (kMode & RUN_DIFF) diff_->Before(*hot_);
     const uint8_t opcode = Read(REG_PC++);
-    Addressing addressing(famicom_);
-    Operation operation(famicom_);
+    if (kMode & RUN_CDL) LogCode(REG_PC - 1, opcode);
+    const uint8_t cycles = CYCLEDATA[opcode];
+    // count ahead, so I/O inside this instruction sees its end time
+    hot_->cycle += (uint64_t)(cycles & CYCLE_MASK) * MASTER_PER_CPU;
+    hot_->page_crossed = 0;
     switch(opcode){
-        OP(4C, ABS, JMP)
-        OP(A2, IMM, LDX)
-        OP(86, ZPG, STX)
-        OP(20, ABS, JSR)
-        OP(EA, IMP, NOP)
-        OP(38, IMP, SEC)
-        OP(B0, REL, BSC)
-        OP(18, IMP, CLC)
-        OP(90, REL, BCC)
-        OP(A9, IMM, LDA)
-        OP(F0, REL, BEQ)
-        OP(D0, REL, BNE)
-        OP(85, ZPG, STA)
-        OP(24, ZPG, BIT)
-        OP(70, REL, BVS)
-        OP(50, REL, BVC)
-        OP(10, REL, BPL)
-        OP(1A, IMP, NOP)
-        OP(3A, IMP, NOP)
-        OP(5A, IMP, NOP)
-        OP(7A, IMP, NOP)
-        OP(DA, IMP, NOP)
-        OP(FA, IMP, NOP)
-        OP(60, IMP, RTS)
-        OP(78, IMP, SEI)
-        OP(F8, IMP, SED)
-        OP(08, IMP, PHP)
-        OP(68, IMP, PLA)
-        OP(80, IMM, NOP)
-        OP(29, IMM, AND)
-        OP(C9, IMM, CMP)
-        OP(D8, IMP, CLD)
-        OP(48, IMP, PHA)
-        OP(28, IMP, PLP)
-        OP(30, REL, BMI)
-        OP(09, IMM, ORA)
-        OP(B8, IMP, CLV)
-        OP(49, IMM, EOR)
-        OP(69, IMM, ADC)
-        OP(A0, IMM, LDY)
-        OP(C0, IMM, CPY)
-        OP(E0, IMM, CPX)
-        OP(E9, IMM, SBC)
-        OP(C8, IMP, INY)
-        OP(E8, IMP, INX)
-        OP(88, IMP, DEY)
-        OP(CA, IMP, DEX)
-        OP(A8, IMP, TAY)
-        OP(AA, IMP, TAX)
-        OP(98, IMP, TYA)
-        OP(8A, IMP, TXA)
-        OP(BA, IMP, TSX)
-        OP(8E, ABS, STX)
-        OP(9A, IMP, TXS)
-        OP(AE, ABS, LDX)
-        OP(AD, ABS, LDA)
-        OP(40, IMP, RTI)
-        OP(4A, ACC, LSRA)
-        OP(0A, ACC, ASLA)
-        OP(6A, ACC, RORA)
-        OP(2A, ACC, ROLA)
-        OP(A5, ZPG, LDA)
-        OP(8D, ABS, STA)
-        OP(A1, INX, LDA)
-        OP(A3, INX, LAX)
-        OP(81, INX, STA)
-        OP(01, INX, ORA)
-        OP(21, INX, AND)
-        OP(41, INX, EOR)
-        OP(61, INX, ADC)
-        OP(C1, INX, CMP)
-        OP(E1, INX, SBC)
-        OP(04, ZPG, NOP)
-        OP(44, ZPG, NOP)
-        OP(64, ZPG, NOP)
-        OP(A4, ZPG, LDY)
-        OP(84, ZPG, STY)
-        OP(A6, ZPG, LDX)
-        OP(A7, ZPG, LAX)
-        OP(05, ZPG, ORA)
-        OP(25, ZPG, AND)
-        OP(45, ZPG, EOR)
-        OP(65, ZPG, ADC)
-        OP(C5, ZPG, CMP)
-        OP(E5, ZPG, SBC)
-        OP(E4, ZPG, CPX)
-        OP(C4, ZPG, CPY)
-        OP(46, ZPG, LSR)
-        OP(06, ZPG, ASL)
-        OP(66, ZPG, ROR)
-        OP(26, ZPG, ROL)
-        OP(E6, ZPG, INC)
-        OP(C6, ZPG, DEC)
-        OP(0C, ABS, NOP)
-        OP(AC, ABS, LDY)
-        OP(8C, ABS, STY)
-        OP(2C, ABS, BIT)
-        OP(0D, ABS, ORA)
-        OP(2D, ABS, AND)
-        OP(4D, ABS, EOR)
-        OP(6D, ABS, ADC)
-        OP(CD, ABS, CMP)
-        OP(ED, ABS, SBC)
-        OP(EC, ABS, CPX)
-        OP(CC, ABS, CPY)
-        OP(4E, ABS, LSR)
-        OP(0E, ABS, ASL)
-        OP(6E, ABS, ROR)
-        OP(2E, ABS, ROL)
-        OP(EE, ABS, INC)
-        OP(CE, ABS, DEC)
-        OP(AF, ABS, LAX)
-        OP(B1, INY, LDA)
-        OP(11, INY, ORA)
-        OP(31, INY, AND)
-        OP(51, INY, EOR)
-        OP(71, INY, ADC)
-        OP(D1, INY, CMP)
-        OP(F1, INY, SBC)
-        OP(91, INY, STA)
-        OP(B3, INY, LAX)
-        OP(6C, IND, JMP)
-        OP(14, ZPX, NOP)
-        OP(15, ZPX, ORA)
-        OP(16, ZPX, ASL)
-        OP(34, ZPX, NOP)
-        OP(35, ZPX, AND)
-        OP(36, ZPX, ROL)
-        OP(54, ZPX, NOP)
-        OP(55, ZPX, EOR)
-        OP(56, ZPX, LSR)
-        OP(74, ZPX, NOP)
-        OP(75, ZPX, ADC)
-        OP(76, ZPX, ROR)
-        OP(94, ZPX, STY)
-        OP(95, ZPX, STA)
-        OP(B4, ZPX, LDY)
-        OP(B5, ZPX, LDA)
-        OP(D4, ZPX, NOP)
-        OP(D5, ZPX, CMP)
-        OP(D6, ZPX, DEC)
-        OP(F4, ZPX, NOP)
-        OP(F5, ZPX, SBC)
-        OP(F6, ZPX, INC)
-        OP(B6, ZPY, LDX)
-        OP(96, ZPY, STX)
-        OP(1C, ABX, NOP)
-        OP(1D, ABX, ORA)
-        OP(1E, ABX, ASL)
-        OP(3C, ABX, NOP)
-        OP(3D, ABX, AND)
-        OP(3E, ABX, ROL)
-        OP(5C, ABX, NOP)
-        OP(5D, ABX, EOR)
-        OP(5E, ABX, LSR)
-        OP(7C, ABX, NOP)
-        OP(7D, ABX, ADC)
-        OP(7E, ABX, ROR)
-        OP(9D, ABX, STA)
-        OP(BC, ABX, LDY)
-        OP(BD, ABX, LDA)
-        OP(DC, ABX, NOP)
-        OP(DD, ABX, CMP)
-        OP(DE, ABX, DEC)
-        OP(FC, ABX, NOP)
-        OP(FD, ABX, SBC)
-        OP(FE, ABX, INC)
-        OP(19, ABY, ORA)
-        OP(39, ABY, AND)
-        OP(59, ABY, EOR)
-        OP(79, ABY, ADC)
-        OP(99, ABY, STA)
-        OP(B9, ABY, LDA)
-        OP(BE, ABY, LDX)
-        OP(D9, ABY, CMP)
-        OP(F9, ABY, SBC)
-        OP(B7, ZPY, LAX)
-        OP(BF, ABY, LAX)
-        OP(83, INX, SAX)
-        OP(87, ZPG, SAX)
-        OP(8F, ABS, SAX)
-        OP(97, ZPY, SAX)
-        OP(EB, IMM, SBC)
-        OP(C3, INX, DCP)
-        OP(C7, ZPG, DCP)
-        OP(CF, ABS, DCP)
-        OP(D3, INY, DCP)
-        OP(D7, ZPX, DCP)
-        OP(DB, ABY, DCP)
-        OP(DF, ABX, DCP)
-        OP(E3, INX, ISB)
-        OP(E7, ZPG, ISB)
-        OP(EF, ABS, ISB)
-        OP(F3, INY, ISB)
-        OP(F7, ZPX, ISB)
-        OP(FB, ABY, ISB)
-        OP(FF, ABX, ISB)
-        OP(03, INX, SLO)
-        OP(07, ZPG, SLO)
-        OP(0F, ABS, SLO)
-        OP(13, INY, SLO)
-        OP(17, ZPX, SLO)
-        OP(1B, ABY, SLO)
-        OP(1F, ABX, SLO)
-        OP(23, INX, RLA)
-        OP(27, ZPG, RLA)
-        OP(2F, ABS, RLA)
-        OP(33, INY, RLA)
-        OP(37, ZPX, RLA)
-        OP(3B, ABY, RLA)
-        OP(3F, ABX, RLA)
-        OP(43, INX, SRE)
-        OP(47, ZPG, SRE)
-        OP(4F, ABS, SRE)
-        OP(53, INY, SRE)
-        OP(57, ZPX, SRE)
-        OP(5B, ABY, SRE)
-        OP(5F, ABX, SRE)
-        OP(63, INX, RRA)
-        OP(67, ZPG, RRA)
-        OP(6F, ABS, RRA)
-        OP(73, INY, RRA)
-        OP(77, ZPX, RRA)
-        OP(7B, ABY, RRA)
-        OP(7F, ABX, RRA)
+        CPU_OPCODES(OP)
     default:
         printf("%X\n", opcode);
         assert(!"exit!");
     }
-    
+    if ((cycles & CYCLE_PAGE) && hot_->page_crossed)
+        hot_->cycle += MASTER_PER_CPU;
+    if (kMode & RUN_DIFF) diff_->After(*hot_);
+}
+
+template<int kMode>
+void Cpu::RunBlock(){
+    Addressing addressing(famicom_, hot_);
+    Operation operation(famicom_, hot_);
+    while (hot_->cycle < hot_->deadline)
+        ExecuteOne<kMode>(addressing, operation);
+}
+
+void Cpu::Run(){
+    // registers, cycle and deadline live in this frame for the whole block
+    alignas(64) CpuState local = famicom_->state_;
+    hot_ = &local;
+    // the loop is picked once per block, so arming the debugger from
+    // outside (Interrupt) takes effect at the next block
+    int mode = 0;
+    if (trace_ || (debugger_ && debugger_->Armed())) mode |= RUN_DEBUG;
+    if (famicom_->cdl_) mode |= RUN_CDL;
+    if (diff_ && !diff_->Failed()) mode |= RUN_DIFF;
+    // one instantiation per combination of RUN_XXX flags
+    typedef void (Cpu::*Block)();
+    static const Block blocks[8] = {
+        &Cpu::RunBlock<0>,
+        &Cpu::RunBlock<RUN_DEBUG>,
+        &Cpu::RunBlock<RUN_CDL>,
+        &Cpu::RunBlock<RUN_DEBUG | RUN_CDL>,
+        &Cpu::RunBlock<RUN_DIFF>,
+        &Cpu::RunBlock<RUN_DIFF | RUN_DEBUG>,
+        &Cpu::RunBlock<RUN_DIFF | RUN_CDL>,
+        &Cpu::RunBlock<RUN_DIFF | RUN_DEBUG | RUN_CDL>,
+    };
+    (this->*blocks[mode])();
+    hot_ = &famicom_->state_;
+    *hot_ = local;
 }
 
 void Cpu::NMI(){
@@ -599,9 +654,23 @@ void Cpu::NMI(){
     const uint8_t pcl = (uint8_t)REG_PC;
     PUSH(pch);
     PUSH(pcl);
-    PUSH(REG_P | (uint8_t)(FLAG_R));
+    PUSH(REG.Status() | (uint8_t)(FLAG_R));
     REG_IF_SE;
     const uint8_t pcl2 = Read(CPU_NMI + 0);
     const uint8_t pch2 = Read(CPU_NMI + 1);
-    famicom_->registers_.programCounter = (uint16_t)pcl2 | (uint16_t)pch2 << 8;
+    REG_PC = (uint16_t)pcl2 | (uint16_t)pch2 << 8;
+    hot_->cycle += 7 * MASTER_PER_CPU;
+}
+
+void Cpu::IRQ(){
+    const uint8_t pch = (uint8_t)((REG_PC) >> 8);
+    const uint8_t pcl = (uint8_t)REG_PC;
+    PUSH(pch);
+    PUSH(pcl);
+    PUSH((REG.Status() | (uint8_t)(FLAG_R)) & ~(uint8_t)FLAG_B);
+    REG_IF_SE;
+    const uint8_t pcl2 = Read(CPU_IRQBRK + 0);
+    const uint8_t pch2 = Read(CPU_IRQBRK + 1);
+    REG_PC = (uint16_t)pcl2 | (uint16_t)pch2 << 8;
+    hot_->cycle += 7 * MASTER_PER_CPU;
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <string>
 #include <iostream>
 #include "code.h"
+#include "disasm.h"
 using std::string;
 // status index
 enum
@@ -37,7 +38,8 @@ enum
 struct CpuRegister{
     // 指令计数器 Program Counter
     uint16_t    programCounter;
-    // 状态寄存器 Status Register
+    // 状态寄存器 Status Register, only I/D/B/R live here,
+    // N/Z/C/V are evaluated lazily from the fields below
     uint8_t     status;
     // 累加寄存器 Accumulator
     uint8_t     accumulator;
@@ -49,6 +51,43 @@ struct CpuRegister{
     uint8_t     stackPointer;
     // 保留对齐用
     uint8_t     unused;
+    // 惰性标志 lazy flags
+    // N: bit 7 of the last result
+    uint8_t     nflag;
+    // Z: set when the last result is zero
+    uint8_t     zflag;
+    // C: 0 or 1
+    uint8_t     cflag;
+    // V: bit 7
+    uint8_t     vflag;
+
+    // materialize the full status register (PHP, interrupts, debugger)
+    uint8_t Status() const {
+        return (status & (uint8_t)(FLAG_I | FLAG_D | FLAG_B | FLAG_R))
+            | (nflag & (uint8_t)FLAG_N)
+            | (zflag ? 0 : (uint8_t)FLAG_Z)
+            | cflag
+            | ((vflag >> 1) & (uint8_t)FLAG_V);
+    }
+    void SetStatus(uint8_t p) {
+        status = p & (uint8_t)(FLAG_I | FLAG_D | FLAG_B | FLAG_R);
+        nflag = p;
+        zflag = !(p & (uint8_t)FLAG_Z);
+        cflag = p & (uint8_t)FLAG_C;
+        vflag = (uint8_t)(p << 1);
+    }
+};
+// Everything the execute loop touches per instruction, 32 bytes so a
+// copy fits one cache line. Famicom owns the canonical copy, Cpu::Run
+// works on a local one and writes it back at I/O and at block exit.
+struct CpuState{
+    CpuRegister registers;
+    // set by indexed addressing when the effective address crosses a page
+    uint8_t     page_crossed;
+    // master cycle counter
+    uint64_t    cycle;
+    // cpu runs uninterrupted until this cycle
+    uint64_t    deadline;
 };
 // cpu vector
 enum
@@ -58,31 +97,67 @@ enum
     CPU_IRQBRK  = 0xFFFE
 };
 
+// execute loop variants
+enum
+{
+    RUN_DEBUG   = 0x01, // trace and debugger checks before every instruction
+    RUN_CDL     = 0x02, // code/data logging at fetch
+    RUN_DIFF    = 0x04, // lockstep comparison with the reference core
+};
+
 class Famicom;
+class Addressing;
+class Operation;
+class Debugger;
+class DiffHarness;
 
 class Cpu
 {
 private:
     Famicom* famicom_;
+    // state in use: Famicom's copy, or the local one while Run() executes
+    CpuState* hot_;
     friend class Addressing;
     friend class Operation;
     Cpu();
+    // sync points around I/O: publish the local state, then pick up
+    // a deadline the I/O may have lowered
+    void Writeback();
+    void Refresh();
+    // everything behind a missing read_map_ entry
+    uint8_t ReadUnmapped(uint16_t);
+    // kMode: RUN_XXX flags, the release loop (0) is instantiated
+    // without any of the checks
+    template<int kMode> void ExecuteOne(Addressing&, Operation&);
+    template<int kMode> void RunBlock();
+    void LogCode(uint16_t pc, uint8_t opcode);
+    void LogData(uint8_t opcode, uint16_t address);
 public:
     Cpu(Famicom&);
+    // print every instruction before executing it
+    bool trace_ = false;
+    // attached debugger, or null
+    Debugger* debugger_ = nullptr;
+    // attached differential harness, or null
+    DiffHarness* diff_ = nullptr;
     uint8_t Read(uint16_t);
+    // read without side effects or watchpoints, I/O reads as 0
+    uint8_t Peek(uint16_t);
     void Write(uint16_t, uint8_t);
     uint8_t ReadPPU(uint16_t);
     void WritePPU(uint16_t, uint8_t);
     uint8_t Read4020(uint16_t);
     void Write4020(uint16_t, uint8_t);
-    string Disassembly(uint16_t address);
-    string btoh(uint8_t);
-    string btod(uint8_t);
-    void ExecuteOne();
+    // true for the opcodes Run() executes, the rest stop the emulator
+    static bool Decodes(uint8_t opcode);
+    // buf: at least DISASM_LINE_SIZE bytes
+    void Disassembly(uint16_t address, char* buf);
+    void Run();
     void Log();
     void NMI();
+    void IRQ();
 };
-#define REG (famicom_->registers_)
+#define REG (hot_->registers)
 #define REG_PC (REG.programCounter)
 #define REG_SP (REG.stackPointer)
 #define REG_A (REG.accumulator)
@@ -91,46 +166,49 @@ public:
 #define REG_P (REG.status)
 
 // if中判断用FLAG
-#define REG_CF (REG_P & (uint8_t)FLAG_C)
-#define REG_ZF (REG_P & (uint8_t)FLAG_Z)
+#define REG_CF (REG.cflag)
+#define REG_ZF (!REG.zflag)
 #define REG_IF (REG_P & (uint8_t)FLAG_I)
 #define REG_DF (REG_P & (uint8_t)FLAG_D)
 #define REG_BF (REG_P & (uint8_t)FLAG_B)
-#define REG_VF (REG_P & (uint8_t)FLAG_V)
-#define REG_SF (REG_P & (uint8_t)FLAG_S)
-#define REG_NF (REG_P & (uint8_t)FLAG_N)
+#define REG_VF (REG.vflag & (uint8_t)0x80)
+#define REG_SF (REG.nflag & (uint8_t)0x80)
+#define REG_NF REG_SF
 // 将FLAG将变为1
-#define REG_CF_SE (REG_P |= (uint8_t)FLAG_C)
-#define REG_ZF_SE (REG_P |= (uint8_t)FLAG_Z)
+#define REG_CF_SE (REG.cflag = 1)
+#define REG_ZF_SE (REG.zflag = 0)
 #define REG_IF_SE (REG_P |= (uint8_t)FLAG_I)
 #define REG_DF_SE (REG_P |= (uint8_t)FLAG_D)
 #define REG_BF_SE (REG_P |= (uint8_t)FLAG_B)
 #define REG_RF_SE (REG_P |= (uint8_t)FLAG_R)
-#define REG_VF_SE (REG_P |= (uint8_t)FLAG_V)
-#define REG_SF_SE (REG_P |= (uint8_t)FLAG_S)
-#define REG_NF_SE (REG_P |= (uint8_t)FLAG_N)
+#define REG_VF_SE (REG.vflag = 0x80)
+#define REG_SF_SE (REG.nflag = 0x80)
+#define REG_NF_SE REG_SF_SE
 // 将FLAG将变为0
-#define REG_CF_CL (REG_P &= ~(uint8_t)FLAG_C)
-#define REG_ZF_CL (REG_P &= ~(uint8_t)FLAG_Z)
+#define REG_CF_CL (REG.cflag = 0)
+#define REG_ZF_CL (REG.zflag = 1)
 #define REG_IF_CL (REG_P &= ~(uint8_t)FLAG_I)
 #define REG_DF_CL (REG_P &= ~(uint8_t)FLAG_D)
 #define REG_BF_CL (REG_P &= ~(uint8_t)FLAG_B)
-#define REG_VF_CL (REG_P &= ~(uint8_t)FLAG_V)
-#define REG_SF_CL (REG_P &= ~(uint8_t)FLAG_S)
-#define REG_NF_CL (REG_P &= ~(uint8_t)FLAG_N)
+#define REG_VF_CL (REG.vflag = 0)
+#define REG_SF_CL (REG.nflag = 0)
+#define REG_NF_CL REG_SF_CL
 // 将FLAG将变为0或者1
-#define REG_CF_IF(x) (x ? REG_CF_SE : REG_CF_CL);
-#define REG_ZF_IF(x) (x ? REG_ZF_SE : REG_ZF_CL);
-#define REG_OF_IF(x) (x ? REG_IF_SE : REG_IF_CL);
-#define REG_DF_IF(x) (x ? REG_DF_SE : REG_DF_CL);
-#define REG_BF_IF(x) (x ? REG_BF_SE : REG_BF_CL);
-#define REG_VF_IF(x) (x ? REG_VF_SE : REG_VF_CL);
-#define REG_SF_IF(x) (x ? REG_SF_SE : REG_SF_CL);
-#define REG_NF_IF(x) (x ? REG_NF_SE : REG_NF_CL);
+#define REG_CF_IF(x) (REG.cflag = (x) ? 1 : 0);
+#define REG_ZF_IF(x) (REG.zflag = (x) ? 0 : 1);
+#define REG_OF_IF(x) ((x) ? REG_IF_SE : REG_IF_CL);
+#define REG_DF_IF(x) ((x) ? REG_DF_SE : REG_DF_CL);
+#define REG_BF_IF(x) ((x) ? REG_BF_SE : REG_BF_CL);
+#define REG_VF_IF(x) (REG.vflag = (x) ? 0x80 : 0);
+#define REG_SF_IF(x) (REG.nflag = (x) ? 0x80 : 0);
+#define REG_NF_IF(x) REG_SF_IF(x)
+// V from bit 7 of an expression, no branch
+#define REG_VF_BIT7(x) (REG.vflag = (uint8_t)(x));
 
-#define PUSH(a) (famicom_->main_memory_ + 0x100)[REG_SP--] = a;
-#define POP() (famicom_->main_memory_ + 0x100)[++REG_SP];
-#define CHECK_ZSFLAG(x) { REG_SF_IF(x & (uint8_t)0x80); REG_ZF_IF(x == 0); }
+#define PUSH(a) Write((uint16_t)(0x100 | REG_SP--), a);
+#define POP() Read((uint16_t)(0x100 | ++REG_SP));
+// N and Z are both taken from the result when they are needed
+#define CHECK_ZSFLAG(x) { REG.nflag = REG.zflag = (uint8_t)(x); }
 
 #include "famicom.h"
 #include "6502.h"
@@ -0,0 +1,248 @@
+#include "debugger.h"
+#include "famicom.h"
+#include "disasm.h"
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+    OP_JSR = 0x20,
+    OP_RTI = 0x40,
+    OP_RTS = 0x60,
+};
+
+static inline bool TestBit(const uint8_t* bits, uint16_t address){
+    return (bits[address >> 3] >> (address & 7)) & 1;
+}
+
+Debugger::Debugger(Famicom& fa){
+    famicom_ = &fa;
+    memset(breakpoints_, 0, sizeof(breakpoints_));
+    memset(watch_read_, 0, sizeof(watch_read_));
+    memset(watch_write_, 0, sizeof(watch_write_));
+}
+
+void Debugger::SetBreakpoint(uint16_t address, bool on){
+    const uint8_t bit = (uint8_t)(1 << (address & 7));
+    uint8_t& byte = breakpoints_[address >> 3];
+    if (on == !!(byte & bit)) return;
+    if (on) {
+        byte |= bit;
+        ++breakpoint_count_;
+    }
+    else {
+        byte &= ~bit;
+        --breakpoint_count_;
+    }
+}
+
+void Debugger::SetWatchpoint(uint16_t first, uint16_t last, uint8_t mode){
+    for (uint32_t address = first; address <= last; ++address) {
+        const uint8_t bit = (uint8_t)(1 << (address & 7));
+        uint8_t& read = watch_read_[address >> 3];
+        uint8_t& write = watch_write_[address >> 3];
+        const bool was = (read | write) & bit;
+        read = (mode & WATCH_READ) ? (read | bit) : (read & ~bit);
+        write = (mode & WATCH_WRITE) ? (write | bit) : (write & ~bit);
+        const bool is = (read | write) & bit;
+        watch_count_ += (int)is - (int)was;
+    }
+    for (uint32_t page = first >> 8; page <= (uint32_t)(last >> 8); ++page)
+        MarkPage((uint8_t)page);
+}
+
+void Debugger::MarkPage(uint8_t page){
+    // 32 bytes of bits per page
+    uint8_t mark = 0;
+    for (int i = 0; i != 32; ++i) {
+        if (watch_read_[page * 32 + i]) mark |= WATCH_READ;
+        if (watch_write_[page * 32 + i]) mark |= WATCH_WRITE;
+    }
+    if (famicom_->watch_pages_[page] == mark) return;
+    famicom_->watch_pages_[page] = mark;
+    famicom_->MapPages(page, 1);
+}
+
+void Debugger::Access(uint16_t address, uint8_t data, bool write){
+    if (!TestBit(write ? watch_write_ : watch_read_, address)) return;
+    // the instruction finishes first, the prompt comes before the next one
+    hit_ = true;
+    hit_write_ = write;
+    hit_address_ = address;
+    hit_data_ = data;
+}
+
+bool Debugger::Check(const CpuState& state){
+    const uint16_t pc = state.registers.programCounter;
+    const uint8_t sp = state.registers.stackPointer;
+    bool stop = hit_ || TestBit(breakpoints_, pc);
+    if (step_ && --step_ == 0) stop = true;
+    if (over_ && pc == over_pc_ && sp >= over_sp_) stop = true;
+    if (out_ && (last_op_ == OP_RTS || last_op_ == OP_RTI) && sp > out_sp_) stop = true;
+    last_op_ = famicom_->cpu_.Peek(pc);
+    if (stop) {
+        step_ = 0;
+        over_ = false;
+        out_ = false;
+    }
+    return stop;
+}
+
+void Debugger::ShowRegisters(const CpuState& state){
+    const CpuRegister& r = state.registers;
+    const uint8_t p = r.Status();
+    char flags[9];
+    const char names[] = "NV-BDIZC";
+    for (int i = 0; i != 8; ++i) flags[i] = (p & (0x80 >> i)) ? names[i] : '.';
+    flags[8] = '\0';
+    printf("PC:%04X A:%02X X:%02X Y:%02X SP:%02X P:%02X %s  CYC:%llu\n",
+        (int)r.programCounter, (int)r.accumulator, (int)r.xIndex, (int)r.yIndex,
+        (int)r.stackPointer, (int)p, flags,
+        (unsigned long long)(state.cycle / MASTER_PER_CPU));
+}
+
+void Debugger::ShowMemory(uint16_t address, int count){
+    for (int row = 0; row < count; row += 16) {
+        printf("%04X:", (int)(uint16_t)(address + row));
+        for (int i = row; i != row + 16 && i < count; ++i) {
+            const uint16_t a = (uint16_t)(address + i);
+            // I/O is not readable without side effects
+            if (famicom_->direct_map_[a >> 8]) printf(" %02X", (int)famicom_->cpu_.Peek(a));
+            else printf(" --");
+        }
+        printf("\n");
+    }
+}
+
+void Debugger::ShowDisassembly(uint16_t address, int count){
+    Cpu& cpu = famicom_->cpu_;
+    char buf[DISASM_LINE_SIZE];
+    for (int i = 0; i != count; ++i) {
+        DisasmLine line;
+        DecodeInstruction(address, cpu.Peek(address),
+            cpu.Peek(address + 1), cpu.Peek(address + 2), line);
+        FormatInstruction(line, buf);
+        printf("%c %s\n", TestBit(breakpoints_, address) ? '*' : ' ', buf);
+        address += line.size;
+    }
+}
+
+void Debugger::List(){
+    for (uint32_t a = 0; a != 0x10000; ++a)
+        if (TestBit(breakpoints_, (uint16_t)a)) printf("break $%04X\n", (int)a);
+    // watch ranges with the same mode are merged
+    uint32_t start = 0;
+    int mode = 0;
+    for (uint32_t a = 0; a <= 0x10000; ++a) {
+        int m = 0;
+        if (a != 0x10000) {
+            m |= TestBit(watch_read_, (uint16_t)a) ? WATCH_READ : 0;
+            m |= TestBit(watch_write_, (uint16_t)a) ? WATCH_WRITE : 0;
+        }
+        if (m == mode) continue;
+        if (mode) printf("watch $%04X-$%04X %s%s\n", (int)start, (int)(a - 1),
+            (mode & WATCH_READ) ? "r" : "", (mode & WATCH_WRITE) ? "w" : "");
+        start = a;
+        mode = m;
+    }
+}
+
+void Debugger::Detach(){
+    memset(breakpoints_, 0, sizeof(breakpoints_));
+    breakpoint_count_ = 0;
+    SetWatchpoint(0x0000, 0xffff, 0);
+    step_ = 0;
+    over_ = false;
+    out_ = false;
+    hit_ = false;
+}
+
+// true when execution resumes
+bool Debugger::Command(const string& line, CpuState& state){
+    char cmd[8] = "";
+    char arg[16] = "";
+    unsigned a = 0, b = 0;
+    const int n = sscanf(line.c_str(), "%7s %x %15s", cmd, &a, arg);
+    const uint16_t pc = state.registers.programCounter;
+    if (n < 1) return false;
+    if (!strcmp(cmd, "c")) return true;
+    if (!strcmp(cmd, "s")) {
+        step_ = n >= 2 && a ? a : 1;
+        return true;
+    }
+    if (!strcmp(cmd, "n")) {
+        if (famicom_->cpu_.Peek(pc) != OP_JSR) step_ = 1;
+        else {
+            over_ = true;
+            over_pc_ = (uint16_t)(pc + 3);
+            over_sp_ = state.registers.stackPointer;
+        }
+        return true;
+    }
+    if (!strcmp(cmd, "o")) {
+        out_ = true;
+        out_sp_ = state.registers.stackPointer;
+        return true;
+    }
+    if (!strcmp(cmd, "q")) {
+        Detach();
+        return true;
+    }
+    if (!strcmp(cmd, "r")) ShowRegisters(state);
+    else if (!strcmp(cmd, "m") && n >= 2) {
+        b = 64;
+        sscanf(line.c_str(), "%*s %x %u", &a, &b);
+        ShowMemory((uint16_t)a, (int)(b > 0x10000 ? 0x10000 : b));
+    }
+    else if (!strcmp(cmd, "d")) ShowDisassembly(n >= 2 ? (uint16_t)a : pc, 10);
+    else if ((!strcmp(cmd, "b") || !strcmp(cmd, "bc")) && n >= 2)
+        SetBreakpoint((uint16_t)a, cmd[1] != 'c');
+    else if ((!strcmp(cmd, "w") || !strcmp(cmd, "wc")) && n >= 2) {
+        // w ADDR[-END] [r|w|rw]
+        b = a;
+        char mode[4] = "rw";
+        sscanf(line.c_str(), "%*s %x-%x", &a, &b);
+        const char* space = strchr(line.c_str() + strlen(cmd) + 1, ' ');
+        if (space) sscanf(space, "%3s", mode);
+        uint8_t m = 0;
+        if (strchr(mode, 'r')) m |= WATCH_READ;
+        if (strchr(mode, 'w')) m |= WATCH_WRITE;
+        if (b < a) b = a;
+        SetWatchpoint((uint16_t)a, (uint16_t)(b > 0xffff ? 0xffff : b), cmd[1] == 'c' ? 0 : m);
+    }
+    else if (!strcmp(cmd, "l")) List();
+    else printf(
+        "c              continue\n"
+        "s [N]          step N instructions\n"
+        "n              step over JSR\n"
+        "o              step out (until RTS/RTI returns)\n"
+        "r              registers\n"
+        "m ADDR [N]     dump N bytes (default 64)\n"
+        "d [ADDR]       disassemble 10 instructions\n"
+        "b ADDR         set breakpoint, bc ADDR clears\n"
+        "w ADDR[-END] [r|w|rw]  set watchpoint, wc ADDR[-END] clears\n"
+        "l              list breakpoints and watchpoints\n"
+        "q              clear everything and continue\n");
+    return false;
+}
+
+void Debugger::Prompt(CpuState& state){
+    if (hit_) {
+        if (hit_write_) printf("watch: write $%02X to $%04X\n", (int)hit_data_, (int)hit_address_);
+        else printf("watch: read $%04X\n", (int)hit_address_);
+        hit_ = false;
+    }
+    ShowRegisters(state);
+    ShowDisassembly(state.registers.programCounter, 1);
+    char buf[128];
+    for (;;) {
+        printf("> ");
+        fflush(stdout);
+        if (!fgets(buf, sizeof(buf), stdin)) {
+            // no console, let the program run
+            Detach();
+            return;
+        }
+        if (Command(buf, state)) return;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef SFCE_DEBUGGER_H_
+#define SFCE_DEBUGGER_H_
+#include <cstdint>
+#include <string>
+using namespace std;
+
+class Famicom;
+struct CpuState;
+
+// watch mode, also the per-page marks in Famicom::watch_pages_
+enum
+{
+    WATCH_READ  = 0x01, // 读观察点
+    WATCH_WRITE = 0x02, // 写观察点
+};
+
+// Breakpoints, watchpoints and stepping with a console prompt.
+// Cpu only runs its checking loop while Armed(). Watchpoints take their
+// page out of the cpu memory map, so only accesses to watched pages (and
+// I/O, which is never mapped) reach Access().
+class Debugger
+{
+private:
+    Famicom*    famicom_;
+    // one bit per address
+    uint8_t     breakpoints_[0x10000 / 8];
+    uint8_t     watch_read_[0x10000 / 8];
+    uint8_t     watch_write_[0x10000 / 8];
+    int         breakpoint_count_ = 0;
+    int         watch_count_ = 0;
+
+    // stepping
+    uint32_t    step_ = 0;
+    bool        over_ = false;
+    uint16_t    over_pc_ = 0;
+    uint8_t     over_sp_ = 0;
+    bool        out_ = false;
+    uint8_t     out_sp_ = 0;
+    uint8_t     last_op_ = 0;
+
+    // watchpoint hit, reported at the next instruction boundary
+    bool        hit_ = false;
+    bool        hit_write_ = false;
+    uint16_t    hit_address_ = 0;
+    uint8_t     hit_data_ = 0;
+
+    void MarkPage(uint8_t page);
+    void ShowRegisters(const CpuState&);
+    void ShowMemory(uint16_t address, int count);
+    void ShowDisassembly(uint16_t address, int count);
+    void List();
+    void Detach();
+    bool Command(const string& line, CpuState&);
+public:
+    Debugger(Famicom&);
+    bool Armed() const {
+        return breakpoint_count_ || watch_count_ || step_ || over_ || out_ || hit_;
+    }
+    void SetBreakpoint(uint16_t address, bool on);
+    // mode: WATCH_READ | WATCH_WRITE, 0 clears
+    void SetWatchpoint(uint16_t first, uint16_t last, uint8_t mode);
+    // break before the next instruction
+    void Interrupt() { step_ = 1; }
+    // called by the cpu for accesses that miss the memory map
+    void Access(uint16_t address, uint8_t data, bool write);
+    // before each instruction in the checking loop, true to stop
+    bool Check(const CpuState&);
+    // interactive prompt on stdin, returns when execution resumes
+    void Prompt(CpuState&);
+};
+
+#endif
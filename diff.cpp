@@ -0,0 +1,173 @@
+#include "diff.h"
+#include "famicom.h"
+#include <cstdio>
+
+void DiffHarness::Attach(Famicom& fa){
+    famicom_ = &fa;
+    fa.unmapped_ = true;
+    fa.MapPages(0, 0x100);
+    fa.cpu_.diff_ = this;
+}
+
+void DiffHarness::Detach(){
+    if (!famicom_) return;
+    famicom_->cpu_.diff_ = nullptr;
+    famicom_->unmapped_ = false;
+    famicom_->MapPages(0, 0x100);
+    famicom_ = nullptr;
+}
+
+void DiffHarness::OnRead(uint16_t address, uint8_t data){
+    // interrupts and DMA also read, only the last instruction is kept
+    if (read_count_ == ACCESS_MAX) return;
+    Access& access = reads_[read_count_++];
+    access.address = address;
+    access.data = data;
+    access.used = 0;
+}
+
+void DiffHarness::OnWrite(uint16_t address, uint8_t data){
+    if (write_count_ == ACCESS_MAX) return;
+    Access& access = writes_[write_count_++];
+    access.address = address;
+    access.data = data;
+    access.used = 0;
+}
+
+uint32_t DiffHarness::Random(){
+    // xorshift32
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    return seed_;
+}
+
+void DiffHarness::Before(const CpuState& state){
+    const uint16_t pc = state.registers.programCounter;
+    // random programs: anything Cpu does not decode becomes another opcode
+    if (!sandbox_.empty()) {
+        uint8_t& opcode = sandbox_[pc];
+        while (!RefCpu::Supported(opcode)) opcode = (uint8_t)Random();
+    }
+    read_count_ = 0;
+    write_count_ = 0;
+    before_ = state;
+    Cpu& cpu = famicom_->cpu_;
+    DecodeInstruction(pc, cpu.Peek(pc), cpu.Peek(pc + 1), cpu.Peek(pc + 2), line_);
+}
+
+uint8_t DiffHarness::BusRead(void* context, uint16_t address){
+    DiffHarness* self = (DiffHarness*)context;
+    for (int i = 0; i != self->read_count_; ++i) {
+        Access& access = self->reads_[i];
+        if (access.used || access.address != address) continue;
+        access.used = 1;
+        return access.data;
+    }
+    if (!self->missing_) {
+        self->missing_ = true;
+        self->missing_address_ = address;
+    }
+    return 0;
+}
+
+void DiffHarness::BusWrite(void* context, uint16_t address, uint8_t data){
+    DiffHarness* self = (DiffHarness*)context;
+    if (self->ref_write_count_ == ACCESS_MAX) return;
+    Access& access = self->ref_writes_[self->ref_write_count_++];
+    access.address = address;
+    access.data = data;
+    access.used = 0;
+}
+
+void DiffHarness::PrintAccesses(const char* name, const Access* list, int count){
+    printf("%-12s", name);
+    if (!count) printf(" -");
+    for (int i = 0; i != count; ++i)
+        printf(" $%04X=%02X", (int)list[i].address, (int)list[i].data);
+    printf("\n");
+}
+
+void DiffHarness::Report(const CpuState& after, int fast_cycles, int ref_cycles){
+    char buf[DISASM_LINE_SIZE];
+    FormatInstruction(line_, buf);
+    const CpuRegister& r = after.registers;
+    const CpuRegister& b = before_.registers;
+    printf("diff: mismatch at instruction %llu\n", (unsigned long long)instructions_);
+    printf("%s\n", buf);
+    printf("        PC    A  X  Y  P  SP  cycles\n");
+    printf("before $%04X %02X %02X %02X %02X %02X\n",
+        (int)b.programCounter, (int)b.accumulator, (int)b.xIndex, (int)b.yIndex,
+        (int)b.Status(), (int)b.stackPointer);
+    printf("fast   $%04X %02X %02X %02X %02X %02X  %d\n",
+        (int)r.programCounter, (int)r.accumulator, (int)r.xIndex, (int)r.yIndex,
+        (int)r.Status(), (int)r.stackPointer, fast_cycles);
+    printf("ref    $%04X %02X %02X %02X %02X %02X  %d\n",
+        (int)ref_.pc, (int)ref_.a, (int)ref_.x, (int)ref_.y,
+        (int)ref_.p, (int)ref_.sp, ref_cycles);
+    PrintAccesses("reads", reads_, read_count_);
+    PrintAccesses("fast writes", writes_, write_count_);
+    PrintAccesses("ref writes", ref_writes_, ref_write_count_);
+    if (missing_) printf("ref read $%04X, the fast core did not\n", (int)missing_address_);
+    if (!ref_cycles) printf("opcode $%02X is not supported by the reference core\n", (int)line_.op);
+}
+
+void DiffHarness::After(CpuState& state){
+    const CpuRegister& b = before_.registers;
+    ref_.pc = b.programCounter;
+    ref_.a = b.accumulator;
+    ref_.x = b.xIndex;
+    ref_.y = b.yIndex;
+    ref_.sp = b.stackPointer;
+    ref_.p = b.Status();
+    ref_write_count_ = 0;
+    missing_ = false;
+    const RefBus bus = { this, BusRead, BusWrite };
+    const int ref_cycles = ref_.Step(bus);
+    const int fast_cycles = (int)((state.cycle - before_.cycle) / MASTER_PER_CPU);
+    ++instructions_;
+
+    const CpuRegister& r = state.registers;
+    bool same = !missing_ && ref_cycles == fast_cycles
+        && ref_.pc == r.programCounter && ref_.a == r.accumulator
+        && ref_.x == r.xIndex && ref_.y == r.yIndex
+        && ref_.sp == r.stackPointer && ref_.p == r.Status()
+        && ref_write_count_ == write_count_;
+    for (int i = 0; same && i != write_count_; ++i)
+        same = writes_[i].address == ref_writes_[i].address && writes_[i].data == ref_writes_[i].data;
+    if (!same) {
+        Report(state, fast_cycles, ref_cycles);
+        failed_ = true;
+        state.deadline = 0;
+        return;
+    }
+    if (limit_ && instructions_ >= limit_) state.deadline = 0;
+}
+
+int DiffHarness::RunRandom(Famicom& fa, uint32_t seed, uint64_t count){
+    seed_ = seed ? seed : 1;
+    sandbox_.resize(0x10000);
+    for (size_t i = 0; i != sandbox_.size(); ++i) sandbox_[i] = (uint8_t)Random();
+    fa.flat_ = sandbox_.data();
+    Attach(fa);
+
+    CpuRegister& r = fa.state_.registers;
+    r.programCounter = (uint16_t)(Random() & 0x07ff);
+    r.accumulator = (uint8_t)Random();
+    r.xIndex = (uint8_t)Random();
+    r.yIndex = (uint8_t)Random();
+    r.stackPointer = (uint8_t)Random();
+    r.SetStatus((uint8_t)Random() | (uint8_t)FLAG_R);
+    limit_ = instructions_ + count;
+    // Run() returns when After() drops the deadline
+    fa.state_.deadline = ~(uint64_t)0;
+    fa.cpu_.Run();
+    limit_ = 0;
+
+    fa.flat_ = nullptr;
+    Detach();
+    sandbox_.clear();
+    printf("diff: %llu random instructions (seed %u)%s\n",
+        (unsigned long long)instructions_, (unsigned)seed, failed_ ? ", mismatch" : "");
+    return failed_ ? ERROR_FILED : ERROR_OK;
+}
@@ -0,0 +1,72 @@
+#ifndef SFCE_DIFF_H_
+#define SFCE_DIFF_H_
+#include <cstdint>
+#include <vector>
+#include "cpu.h"
+#include "disasm.h"
+#include "refcpu.h"
+using namespace std;
+
+class Famicom;
+
+// Differential execution: RefCpu re-runs every instruction the fast core
+// executes and the two are compared at the instruction boundary.
+// Attaching takes the whole memory map off the fast path, so every bus
+// access of Cpu is logged. RefCpu reads are served from that log (I/O is
+// never touched twice), its writes are compared against it.
+class DiffHarness
+{
+private:
+    enum { ACCESS_MAX = 32 };
+    struct Access
+    {
+        uint16_t address;
+        uint8_t  data;
+        uint8_t  used;      // read already handed to RefCpu
+    };
+    Famicom*    famicom_ = nullptr;
+    // accesses of the current instruction
+    Access      reads_[ACCESS_MAX];
+    Access      writes_[ACCESS_MAX];
+    Access      ref_writes_[ACCESS_MAX];
+    int         read_count_ = 0;
+    int         write_count_ = 0;
+    int         ref_write_count_ = 0;
+    // RefCpu read something Cpu never did
+    bool        missing_ = false;
+    uint16_t    missing_address_ = 0;
+
+    CpuState    before_;
+    DisasmLine  line_;
+    RefCpu      ref_;
+    uint64_t    instructions_ = 0;
+    // stop after this many instructions, 0: never
+    uint64_t    limit_ = 0;
+    bool        failed_ = false;
+
+    // randomized programs
+    vector<uint8_t> sandbox_;
+    uint32_t    seed_ = 0;
+
+    uint32_t Random();
+    static uint8_t BusRead(void* context, uint16_t address);
+    static void BusWrite(void* context, uint16_t address, uint8_t data);
+    static void PrintAccesses(const char* name, const Access* list, int count);
+    void Report(const CpuState& after, int fast_cycles, int ref_cycles);
+public:
+    void Attach(Famicom&);
+    void Detach();
+    // bus accesses of Cpu that miss the memory map
+    void OnRead(uint16_t address, uint8_t data);
+    void OnWrite(uint16_t address, uint8_t data);
+    // around every instruction in the diff loop
+    void Before(const CpuState&);
+    void After(CpuState&);
+    // `count` instructions of random bytes in a flat 64KB sandbox,
+    // returns ERROR_OK or ERROR_FILED on the first mismatch
+    int RunRandom(Famicom&, uint32_t seed, uint64_t count);
+    bool Failed() const { return failed_; }
+    uint64_t Instructions() const { return instructions_; }
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include "disasm.h"
+#include <string.h>
+
+static inline char* PutHex8(char* p, uint8_t b){
+    p[0] = HEXDATA[b >> 4];
+    p[1] = HEXDATA[b & (uint8_t)0x0F];
+    return p + 2;
+}
+static inline char* PutHex16(char* p, uint16_t w){
+    p = PutHex8(p, (uint8_t)(w >> 8));
+    return PutHex8(p, (uint8_t)w);
+}
+static inline char* PutStr(char* p, const char* s){
+    while (*s) *p++ = *s++;
+    return p;
+}
+
+int InstructionSize(uint8_t mode){
+    switch (mode) {
+    case AM_IMM: case AM_ZPG: case AM_ZPX: case AM_ZPY:
+    case AM_INX: case AM_INY: case AM_REL:
+        return 2;
+    case AM_ABS: case AM_ABX: case AM_ABY: case AM_IND:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+void DecodeInstruction(uint16_t address, uint8_t op, uint8_t a1, uint8_t a2, DisasmLine& line){
+    const OpName& opname = OPNAMEDATA[op];
+    line.address = address;
+    line.op = op;
+    line.a1 = a1;
+    line.a2 = a2;
+    line.mode = opname.mode;
+    line.size = (uint8_t)InstructionSize(opname.mode);
+    line.has_target = 0;
+    line.target = 0;
+    if (opname.mode == AM_REL) {
+        line.target = (uint16_t)(address + 2 + (int8_t)a1);
+        line.has_target = 1;
+    }
+    // JMP $ABCD / JSR $ABCD
+    else if (op == 0x4C || op == 0x20) {
+        line.target = (uint16_t)a1 | (uint16_t)a2 << 8;
+        line.has_target = 1;
+    }
+}
+
+// `label` prints the target as "L_XXXX" instead of "$XXXX"
+static char* Format(const DisasmLine& line, char* p, bool label){
+    char* const begin = p;
+    const OpName& opname = OPNAMEDATA[line.op];
+    *p++ = '$';
+    p = PutHex16(p, line.address);
+    p = PutStr(p, "     ");
+    *p++ = opname.name[0];
+    *p++ = opname.name[1];
+    *p++ = opname.name[2];
+    p = PutStr(p, "    ");
+
+    if (label && line.has_target) {
+        p = PutStr(p, "L_");
+        p = PutHex16(p, line.target);
+    }
+    else switch (line.mode)
+    {
+    case AM_UNK:
+    case AM_IMP:
+        // XXX
+        break;
+    case AM_ACC:
+        // XXX A
+        *p++ = 'A';
+        break;
+    case AM_IMM:
+        // XXX #$AB
+        p = PutStr(p, "#$");
+        p = PutHex8(p, line.a1);
+        break;
+    case AM_ABS:
+    case AM_ABX:
+    case AM_ABY:
+        // XXX $ABCD[,X|,Y]
+        *p++ = '$';
+        p = PutHex8(p, line.a2);
+        p = PutHex8(p, line.a1);
+        if (line.mode == AM_ABX) p = PutStr(p, ",X");
+        if (line.mode == AM_ABY) p = PutStr(p, ",Y");
+        break;
+    case AM_ZPG:
+    case AM_ZPX:
+    case AM_ZPY:
+        // XXX $AB[,X|,Y]
+        *p++ = '$';
+        p = PutHex8(p, line.a1);
+        if (line.mode == AM_ZPX) p = PutStr(p, ",X");
+        if (line.mode == AM_ZPY) p = PutStr(p, ",Y");
+        break;
+    case AM_INX:
+        // XXX ($AB,X)
+        p = PutStr(p, "($");
+        p = PutHex8(p, line.a1);
+        p = PutStr(p, ",X)");
+        break;
+    case AM_INY:
+        // XXX ($AB),Y
+        p = PutStr(p, "($");
+        p = PutHex8(p, line.a1);
+        p = PutStr(p, "),Y");
+        break;
+    case AM_IND:
+        // XXX ($ABCD)
+        p = PutStr(p, "($");
+        p = PutHex8(p, line.a2);
+        p = PutHex8(p, line.a1);
+        *p++ = ')';
+        break;
+    case AM_REL:
+        // XXX $ABCD
+        *p++ = '$';
+        p = PutHex16(p, line.target);
+        break;
+    }
+    while (p - begin < DISASM_LINE_SIZE - 1) *p++ = ' ';
+    return p;
+}
+
+void FormatInstruction(const DisasmLine& line, char* buf){
+    char* end = Format(line, buf, false);
+    *end = '\0';
+}
+
+size_t DisassembleBank(const uint8_t* data, size_t size, uint16_t base,
+    DisasmLine* lines, size_t max_lines){
+    size_t count = 0;
+    size_t offset = 0;
+    while (offset < size && count < max_lines) {
+        // operands past the end of the bank read as zero
+        const uint8_t op = data[offset];
+        const uint8_t a1 = offset + 1 < size ? data[offset + 1] : 0;
+        const uint8_t a2 = offset + 2 < size ? data[offset + 2] : 0;
+        DisasmLine& line = lines[count++];
+        DecodeInstruction((uint16_t)(base + offset), op, a1, a2, line);
+        offset += line.size;
+    }
+    return count;
+}
+
+size_t FormatListing(const DisasmLine* lines, size_t count, char* out, size_t out_size){
+    // bitmaps over the 64KB address space
+    uint8_t starts[0x10000 / 8];
+    uint8_t targets[0x10000 / 8];
+    memset(starts, 0, sizeof(starts));
+    memset(targets, 0, sizeof(targets));
+    for (size_t i = 0; i != count; ++i) {
+        const uint16_t a = lines[i].address;
+        starts[a >> 3] |= (uint8_t)(1 << (a & 7));
+    }
+    for (size_t i = 0; i != count; ++i) {
+        if (!lines[i].has_target) continue;
+        const uint16_t t = lines[i].target;
+        if (starts[t >> 3] & (1 << (t & 7)))
+            targets[t >> 3] |= (uint8_t)(1 << (t & 7));
+    }
+
+    size_t length = 0;
+    size_t written = 0;
+    char buf[DISASM_LINE_SIZE + 16];
+    for (size_t i = 0; i != count; ++i) {
+        const DisasmLine& line = lines[i];
+        char* p = buf;
+        const uint16_t a = line.address;
+        if (targets[a >> 3] & (1 << (a & 7))) {
+            p = PutStr(p, "L_");
+            p = PutHex16(p, a);
+            p = PutStr(p, ":\n");
+        }
+        const uint16_t t = line.target;
+        const bool label = line.has_target && (targets[t >> 3] & (1 << (t & 7)));
+        p = Format(line, p, label);
+        // no trailing padding in listings
+        while (p[-1] == ' ') --p;
+        *p++ = '\n';
+
+        const size_t n = (size_t)(p - buf);
+        if (length + n < out_size) {
+            memcpy(out + length, buf, n);
+            written = length + n;
+        }
+        length += n;
+    }
+    if (out_size) out[written] = '\0';
+    return length;
+}
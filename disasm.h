@@ -0,0 +1,43 @@
+#ifndef SFCE_DISASM_H_
+#define SFCE_DISASM_H_
+#include <cstddef>
+#include <cstdint>
+#include "code.h"
+
+// one formatted line: "$C28F     CMP    $D2" padded to 32 columns + '\0'
+enum { DISASM_LINE_SIZE = 32 + 1 };
+
+// decoded instruction
+struct DisasmLine
+{
+    uint16_t address;
+    uint16_t target;    // effective branch/jump target, valid if has_target
+    uint8_t  op;
+    uint8_t  a1;
+    uint8_t  a2;
+    uint8_t  mode;      // AM_XXX
+    uint8_t  size;      // 1..3 bytes
+    uint8_t  has_target;
+};
+
+// size of the instruction in bytes for an addressing mode
+int InstructionSize(uint8_t mode);
+
+// decode one instruction from up to 3 bytes at `address`
+void DecodeInstruction(uint16_t address, uint8_t op, uint8_t a1, uint8_t a2, DisasmLine& line);
+
+// format one instruction into `buf` (at least DISASM_LINE_SIZE bytes), no allocation
+void FormatInstruction(const DisasmLine& line, char* buf);
+
+// Whole bank batch disassembly.
+// Decodes `size` bytes of `data` mapped at `base` into `lines` (at most
+// max_lines entries), returns number of decoded lines.
+size_t DisassembleBank(const uint8_t* data, size_t size, uint16_t base,
+    DisasmLine* lines, size_t max_lines);
+
+// Writes a listing of decoded lines into `out`, branch/jump targets that
+// land inside the listing get an "L_XXXX:" label and are printed by label.
+// Returns the number of chars needed (excluding '\0'), like snprintf.
+size_t FormatListing(const DisasmLine* lines, size_t count, char* out, size_t out_size);
+
+#endif
@@ -0,0 +1,113 @@
+#include "env.h"
+#include "famicom.h"
+
+VectorEnv::~VectorEnv(){
+    Release();
+}
+
+void VectorEnv::Release(){
+    bands_.Stop();
+    for (size_t i = 0; i != machines_.size(); ++i) pool_->Destroy(machines_[i]);
+    machines_.clear();
+}
+
+int VectorEnv::Init(const Famicom& source, int count, const EnvSpec& spec, int threads){
+    Release();
+    if (count < 1 || spec.frameskip < 1 || spec.ram_offset + spec.ram_length > 0x8000
+        || (spec.reward != REWARD_NONE && (spec.reward_bytes < 1 || spec.reward_bytes > 8))
+        || (spec.max_pool && (!spec.obs_width || spec.frameskip < 2)))
+        return ERROR_UNSUPPORTED;
+    if (spec.obs_width && obs_.Init(spec.obs_width, spec.obs_height) != 0) return ERROR_UNSUPPORTED;
+    spec_ = spec;
+    pooled_.assign(spec.max_pool ? obs_.Size() * count : 0, 0);
+    start_.clear();
+    source.SaveState(start_);
+    pool_.reset(new FamicomPool((size_t)count));
+    for (int i = 0; i != count; ++i) {
+        Famicom* fc = pool_->Create();
+        int code = fc ? fc->Init(source) : ERROR_OUT_OF_MEMORY;
+        if (code == 0) code = fc->LoadState(start_.data(), start_.size());
+        if (code != 0) {
+            if (fc) pool_->Destroy(fc);
+            Release();
+            return code;
+        }
+        machines_.push_back(fc);
+    }
+    scores_.assign((size_t)count, 0);
+    for (size_t i = 0; i != machines_.size(); ++i) scores_[i] = Score(*machines_[i]);
+    if (threads < 1) threads = 1;
+    if (threads > count) threads = count;
+    bands_.Start(threads, &VectorEnv::Band, this);
+    return 0;
+}
+
+int64_t VectorEnv::Score(Famicom& fc){
+    int64_t score = 0;
+    for (int i = 0; i != spec_.reward_bytes; ++i) {
+        if (spec_.reward == REWARD_BINARY)
+            score |= (int64_t)fc.cpu_.Peek((uint16_t)(spec_.reward_address + i)) << (i * 8);
+        else if (spec_.reward == REWARD_DIGITS)
+            score = score * 10 + fc.cpu_.Peek((uint16_t)(spec_.reward_address + i)) % 10;
+    }
+    return score;
+}
+
+void VectorEnv::Observe(const Famicom& fc, uint8_t* out) const{
+    if (spec_.obs_width) obs_.Render(fc, out);
+    else RenderIndices(fc, out);
+}
+
+// one instance, with the arguments of the current Step() or Reset()
+void VectorEnv::Run(size_t index){
+    Famicom& fc = *machines_[index];
+    const size_t size = ObservationSize();
+    const bool pool = spec_.max_pool && observations_ && !resetting_;
+    if (resetting_) fc.LoadState(start_.data(), start_.size());
+    else {
+        fc.SetControllerBits(0, actions_[index]);
+        for (int f = 0; f != spec_.frameskip; ++f) {
+            fc.RunFrame();
+            if (pool && f == spec_.frameskip - 2) Observe(fc, &pooled_[index * size]);
+        }
+    }
+    const int64_t score = Score(fc);
+    if (rewards_) rewards_[index] = (int32_t)(score - scores_[index]);
+    scores_[index] = score;
+    if (observations_) {
+        Observe(fc, observations_ + index * size);
+        if (pool) MaxPool(&pooled_[index * size], observations_ + index * size, size);
+    }
+    if (ram_) {
+        uint8_t* out = ram_ + index * spec_.ram_length;
+        for (int i = 0; i != spec_.ram_length; ++i) out[i] = fc.cpu_.Peek((uint16_t)(spec_.ram_offset + i));
+    }
+}
+
+void VectorEnv::Band(void* self, int band, int bands){
+    static_cast<VectorEnv*>(self)->Band(band, bands);
+}
+
+void VectorEnv::Band(int band, int bands){
+    const size_t first = machines_.size() * band / bands;
+    const size_t last = machines_.size() * (band + 1) / bands;
+    for (size_t i = first; i != last; ++i) Run(i);
+}
+
+void VectorEnv::Reset(uint8_t* observations){
+    resetting_ = true;
+    actions_ = nullptr;
+    observations_ = observations;
+    rewards_ = nullptr;
+    ram_ = nullptr;
+    bands_.Run();
+    resetting_ = false;
+}
+
+void VectorEnv::Step(const uint8_t* actions, uint8_t* observations, int32_t* rewards, uint8_t* ram){
+    actions_ = actions;
+    observations_ = observations;
+    rewards_ = rewards;
+    ram_ = ram;
+    bands_.Run();
+}
@@ -0,0 +1,84 @@
+#ifndef SFCE_ENV_H_
+#define SFCE_ENV_H_
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include "bands.h"
+#include "pool.h"
+#include "obs.h"
+using namespace std;
+
+// how the reward is read from RAM
+enum
+{
+    REWARD_NONE = 0,    // always 0
+    REWARD_BINARY,      // little-endian counter
+    REWARD_DIGITS,      // a decimal digit per byte, most significant first
+};
+
+struct EnvSpec
+{
+    int         frameskip = 4;      // frames per step, the action is held for all
+    uint16_t    ram_offset = 0;     // RAM slice copied out after each step
+    uint16_t    ram_length = 0;
+    int         reward = REWARD_NONE;
+    uint16_t    reward_address = 0; // reward is the change of this counter
+    uint8_t     reward_bytes = 0;   // 1-8
+    // observation: 0 for the 256x240 NES colour indices, else the size of
+    // a luminance one, see ObservationRenderer
+    int         obs_width = 0;
+    int         obs_height = 0;
+    // luminance observation: maximum of the last two frames of a step
+    bool        max_pool = false;
+};
+
+// Batch of machines stepped together for agent training.
+// Every instance starts from the state of the source machine and shares
+// its ROM. Step() sets each instance's controller to its action, runs it
+// for frameskip frames and writes its observation, its reward and its RAM
+// slice into the caller's arrays, instance i at i * size. Instances are split into bands
+// over a small thread pool, the caller runs the first band; nothing is
+// allocated after Init().
+class VectorEnv
+{
+private:
+    EnvSpec         spec_;
+    unique_ptr<FamicomPool> pool_;
+    vector<Famicom*> machines_;
+    // state every instance starts from, see Reset()
+    vector<uint8_t> start_;
+    // last reward counter value per instance
+    vector<int64_t> scores_;
+    ObservationRenderer obs_;
+    // next to last frame of each instance when max pooling
+    vector<uint8_t> pooled_;
+
+    BandPool        bands_;
+    bool            resetting_ = false;
+    const uint8_t*  actions_ = nullptr;
+    uint8_t*        observations_ = nullptr;
+    int32_t*        rewards_ = nullptr;
+    uint8_t*        ram_ = nullptr;
+
+    int64_t Score(Famicom& fc);
+    void Observe(const Famicom& fc, uint8_t* out) const;
+    void Run(size_t index);
+    static void Band(void* self, int band, int bands);
+    void Band(int band, int bands);
+    void Release();
+public:
+    ~VectorEnv();
+    // `count` instances of `source` as it is now, `threads` including the caller
+    int Init(const Famicom& source, int count, const EnvSpec& spec, int threads);
+    size_t Count() const { return machines_.size(); }
+    // bytes of one observation
+    size_t ObservationSize() const { return spec_.obs_width ? obs_.Size() : 256 * 240; }
+    // every instance back to the start state, observations may be null
+    void Reset(uint8_t* observations);
+    // actions: controller bits per instance; any output may be null
+    void Step(const uint8_t* actions, uint8_t* observations, int32_t* rewards, uint8_t* ram);
+    Famicom& Instance(size_t index) { return *machines_[index]; }
+};
+
+#endif
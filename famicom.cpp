@@ -1,20 +1,185 @@
 #include "famicom.h"
+#include "hash.h"
 #include <assert.h>
+#include <string.h>
 #include <fstream>
 #include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 using namespace std;
 
-int Famicom::Init(string romfile){
-    // set banks
-    prg_banks_[0] = main_memory_;
-    prg_banks_[3] = save_memory_;
+static const uint16_t STATE_VERSION = 1;
+static const uint16_t DELTA_VERSION = 2;
+// delta record index of the register block, after the dirty bits
+static const int      DELTA_REGISTERS = DIRTY_COUNT;
+
+// where a ppu bank points, stored as tag << 24 | offset
+enum
+{
+    STATE_BANK_CHR  = 0,    // CHR-ROM
+    STATE_BANK_VRAM,        // video_memory_
+    STATE_BANK_VRAM_EX,     // video_memory_ex_
+    STATE_BANK_NONE = 0xff,
+};
+
+// machine state as written after StateHeader
+struct StateImage
+{
+    CpuState    cpu;
+    // banks are meaningless here, see ppu_banks
+    PPU         ppu;
+    Scheduler   scheduler;
+    Scheduler   ppu_events;
+    uint64_t    ppu_cycle;
+    uint64_t    frame_base;
+    uint64_t    frame_count;
+    // PRG-ROM offset of each 8KB window in [$8000,$10000)
+    uint32_t    prg_banks[4];
+    uint32_t    ppu_banks[0x4000 / 0x0400];
+    uint16_t    controller1;
+    uint16_t    controller2;
+    uint16_t    controller_status_mask;
+    uint8_t     controller_states[16];
+    uint8_t     irq_lines;
+    uint8_t     dma_page;
+    uint8_t     main_memory[2 * 1024];
+    uint8_t     video_memory[2 * 1024];
+    uint8_t     video_memory_ex[2 * 1024];
+    uint8_t     save_memory[8 * 1024];
+};
+
+// incremental snapshot, see Famicom::SaveDelta: this header, then
+// `records` records, see AppendSpans
+struct DeltaHeader
+{
+    uint32_t    id;             // "SFCD"
+    uint16_t    version;
+    uint16_t    records;
+    uint64_t    rom_hash;
+};
+
+// everything but memory, events as the pending deadline of each type
+struct StateRegisters
+{
+    CpuState    cpu;
+    uint64_t    ppu_cycle;
+    uint64_t    frame_base;
+    uint64_t    frame_count;
+    uint64_t    events[EVENT_COUNT];
+    uint64_t    ppu_events[EVENT_COUNT];
+    uint32_t    prg_banks[4];
+    uint32_t    ppu_banks[0x4000 / 0x0400];
+    uint16_t    vramaddr;
+    uint16_t    scanline;
+    uint16_t    dot;
+    uint16_t    controller1;
+    uint16_t    controller2;
+    uint16_t    controller_status_mask;
+    uint8_t     ctrl;
+    uint8_t     mask;
+    uint8_t     status;
+    uint8_t     oamaddr;
+    uint8_t     scroll[2];
+    uint8_t     writex2;
+    uint8_t     pseudo;
+    uint8_t     controller_states[16];
+    uint8_t     irq_lines;
+    uint8_t     dma_page;
+};
+
+static uint32_t DeltaId(){
+    union {uint32_t u32; uint8_t id[4];} id;
+    id.id[0] = 'S';
+    id.id[1] = 'F';
+    id.id[2] = 'C';
+    id.id[3] = 'D';
+    return id.u32;
+}
+
+static uint32_t StateId(){
+    union {uint32_t u32; uint8_t id[4];} id;
+    id.id[0] = 'S';
+    id.id[1] = 'F';
+    id.id[2] = 'C';
+    id.id[3] = 'S';
+    return id.u32;
+}
+
+Famicom::Famicom() : cpu_(*this){
+    palette_lut_ = PaletteLut(PIXEL_RGBA);
+    memset(&state_, 0, sizeof(state_));
+    memset(read_map_, 0, sizeof(read_map_));
+    memset(write_map_, 0, sizeof(write_map_));
+    memset(page_map_, 0, sizeof(page_map_));
+    memset(direct_map_, 0, sizeof(direct_map_));
+    memset(watch_pages_, 0, sizeof(watch_pages_));
+    memset(&rom_, 0, sizeof(rom_));
+    for (int i = 0; i != RAM_PAGE_COUNT; ++i) ram_pages_[i] = OwnRamPage(i);
+    for (int i = 0; i != VRAM_UNIT_COUNT; ++i) vram_units_[i] = OwnVramUnit(i);
+}
 
+Famicom::~Famicom(){
+    assert(!forks_ && "forks must not outlive their parent");
+    Release();
+    delete[] save_memory_;
+    delete[] delta_base_;
+}
+
+int Famicom::Init(string romfile){
     // load rom
     auto code = LoadRom(romfile);
     if(code != 0) return code;
+    // FNV-1a over PRG and CHR
+    const size_t size = 16 * 1024 * rom_.count_16k + 8 * 1024 * rom_.count_8k;
+    rom_hash_ = 14695981039346656037ull;
+    for (size_t i = 0; i != size; ++i) {
+        rom_hash_ ^= rom_.prg[i];
+        rom_hash_ *= 1099511628211ull;
+    }
+
+    return PowerOn();
+}
+
+int Famicom::Init(const Famicom& source){
+    if (!source.loaded_) return ERROR_ILLEGAL_FILE;
+    rom_ = source.rom_;
+    rom_data_ = source.rom_data_;
+    rom_hash_ = source.rom_hash_;
+    loaded_ = true;
+    return PowerOn();
+}
+
+int Famicom::PowerOn(){
+    assert(!forks_ && "machine has live forks");
+    Release();
+    // SRAM only for cartridges that have it, $6000-$7FFF is open bus otherwise
+    if (rom_.save_ram && !save_memory_) save_memory_ = new uint8_t[8 * 1024];
+    if (!rom_.save_ram) {
+        delete[] save_memory_;
+        save_memory_ = nullptr;
+    }
+    // power-on state is all zero, so runs are reproducible
+    if (save_memory_) memset(save_memory_, 0, 8 * 1024);
+    memset(video_memory_, 0, sizeof(video_memory_));
+    memset(video_memory_ex_, 0, sizeof(video_memory_ex_));
+    memset(main_memory_, 0, sizeof(main_memory_));
+    memset(&ppu_, 0, sizeof(ppu_));
+    UpdateColors();
+    StartRaster();
+    memset(controller_states_, 0, sizeof(controller_states_));
+    controller1_ = 0;
+    controller2_ = 0;
+    controller_status_mask_ = 0;
+
+    // set banks
+    prg_banks_[0] = main_memory_;
+    prg_banks_[3] = save_memory_;
+    for (int i = 0; i != RAM_PAGE_COUNT; ++i) ram_pages_[i] = OwnRamPage(i);
+    for (int i = 0; i != VRAM_UNIT_COUNT; ++i) vram_units_[i] = OwnVramUnit(i);
+    memset(dirty_tiles_, 0xff, sizeof(dirty_tiles_));
 
-    cpu_ = new Cpu(*this);
-    
     return Reset();
 }
 
@@ -41,6 +206,7 @@ int Famicom::LoadRom(string romfile){
             // load rom from file
             romfile_if.read((char*)ptr, prg_size + chr_size);
             // write info to rom_
+            rom_data_.reset(ptr, default_delete<uint8_t[]>());
             rom_.prg = ptr;
             rom_.chr = ptr + prg_size;
             rom_.count_16k = file_header.count_16k;
@@ -77,11 +243,668 @@ void Famicom::ShowInfo(){
     }
 }
 
+uint64_t Famicom::RomHash() const{
+    return rom_hash_;
+}
+
+uint64_t Famicom::StateHash() const{
+    const uint8_t regs[7] = {
+        (uint8_t)state_.registers.programCounter,
+        (uint8_t)(state_.registers.programCounter >> 8),
+        state_.registers.accumulator,
+        state_.registers.xIndex,
+        state_.registers.yIndex,
+        state_.registers.stackPointer,
+        state_.registers.Status(),
+    };
+    // a fork's pages may live in its parent
+    uint8_t ram[2 * 1024];
+    uint8_t vram[4 * 1024];
+    GatherRam(ram);
+    GatherVram(vram);
+    uint64_t hash = Hash64(regs, sizeof(regs));
+    hash = Hash64(ram, sizeof(ram), hash);
+    hash = Hash64(vram, 2 * 1024, hash);
+    hash = Hash64(vram + 2 * 1024, 2 * 1024, hash);
+    hash = Hash64(ppu_.spindexes, sizeof(ppu_.spindexes), hash);
+    return Hash64(ppu_.sprites, sizeof(ppu_.sprites), hash);
+}
+
+void Famicom::SaveState(vector<uint8_t>& out) const{
+    out.resize(sizeof(StateHeader) + sizeof(StateImage));
+    StateHeader header;
+    memset(&header, 0, sizeof(header));
+    header.id = StateId();
+    header.version = STATE_VERSION;
+    header.header_size = sizeof(StateHeader);
+    header.rom_hash = RomHash();
+    header.state_size = sizeof(StateImage);
+    memcpy(out.data(), &header, sizeof(header));
+
+    StateImage* image = (StateImage*)(out.data() + sizeof(header));
+    image->cpu = state_;
+    image->ppu = ppu_;
+    memset(image->ppu.banks, 0, sizeof(image->ppu.banks));
+    image->scheduler = scheduler_;
+    image->ppu_events = ppu_events_;
+    image->ppu_cycle = ppu_cycle_;
+    image->frame_base = frame_base_;
+    image->frame_count = frame_count_;
+    EncodeBanks(image->prg_banks, image->ppu_banks);
+    image->controller1 = controller1_;
+    image->controller2 = controller2_;
+    image->controller_status_mask = controller_status_mask_;
+    memcpy(image->controller_states, controller_states_, sizeof(controller_states_));
+    image->irq_lines = irq_lines_;
+    image->dma_page = dma_page_;
+    GatherRam(image->main_memory);
+    uint8_t vram[4 * 1024];
+    GatherVram(vram);
+    memcpy(image->video_memory, vram, sizeof(image->video_memory));
+    memcpy(image->video_memory_ex, vram + 2 * 1024, sizeof(image->video_memory_ex));
+    for (int i = 0; i != 32; ++i) {
+        if (save_memory_) memcpy(image->save_memory + (i << 8), ram_pages_[8 + i], 0x100);
+        else memset(image->save_memory + (i << 8), 0, 0x100);
+    }
+}
+
+int Famicom::LoadState(const uint8_t* data, size_t size){
+    StateHeader header;
+    if (size < sizeof(header)) return ERROR_ILLEGAL_FILE;
+    memcpy(&header, data, sizeof(header));
+    if (header.id != StateId() || header.version != STATE_VERSION
+        || header.header_size != sizeof(StateHeader) || header.state_size != sizeof(StateImage)
+        || size < sizeof(StateHeader) + sizeof(StateImage))
+        return ERROR_ILLEGAL_FILE;
+    if (header.rom_hash != RomHash()) return ERROR_ROM_MISMATCH;
+    // forks read this machine's memory
+    if (forks_) return ERROR_UNSUPPORTED;
+
+    // the mapping may not be aligned for StateImage
+    StateImage image;
+    memcpy(&image, data + sizeof(StateHeader), sizeof(image));
+    if (!CheckBanks(image.prg_banks, image.ppu_banks)) return ERROR_ILLEGAL_FILE;
+
+    // everything below lands in this machine's own memory
+    Release();
+    for (int i = 0; i != RAM_PAGE_COUNT; ++i) ram_pages_[i] = OwnRamPage(i);
+    for (int i = 0; i != VRAM_UNIT_COUNT; ++i) vram_units_[i] = OwnVramUnit(i);
+    state_ = image.cpu;
+    ppu_ = image.ppu;
+    DecodeBanks(image.prg_banks, image.ppu_banks);
+    scheduler_ = image.scheduler;
+    ppu_events_ = image.ppu_events;
+    ppu_cycle_ = image.ppu_cycle;
+    frame_base_ = image.frame_base;
+    frame_count_ = image.frame_count;
+    controller1_ = image.controller1;
+    controller2_ = image.controller2;
+    controller_status_mask_ = image.controller_status_mask;
+    memcpy(controller_states_, image.controller_states, sizeof(controller_states_));
+    irq_lines_ = image.irq_lines;
+    dma_page_ = image.dma_page;
+    memcpy(main_memory_, image.main_memory, sizeof(main_memory_));
+    memcpy(video_memory_, image.video_memory, sizeof(video_memory_));
+    memcpy(video_memory_ex_, image.video_memory_ex, sizeof(video_memory_ex_));
+    if (save_memory_) memcpy(save_memory_, image.save_memory, 8 * 1024);
+    MapPages(0, 0x100);
+    memset(dirty_tiles_, 0xff, sizeof(dirty_tiles_));
+    UpdateColors();
+    StartRaster();
+    // the loaded state is the new base for deltas
+    Rebase();
+    ProtectPages();
+    return 0;
+}
+
+void Famicom::EncodeBanks(uint32_t* prg, uint32_t* ppu) const{
+    for (int i = 0; i != 4; ++i)
+        prg[i] = (uint32_t)(prg_banks_[4 + i] - rom_.prg);
+    const uint8_t* const chr_end = rom_.chr + 8 * 1024 * rom_.count_8k;
+    for (int i = 0; i != 0x4000 / 0x0400; ++i) {
+        const uint8_t* bank = ppu_.banks[i];
+        uint32_t tag = STATE_BANK_NONE, offset = 0;
+        if (bank >= rom_.chr && bank < chr_end) tag = STATE_BANK_CHR, offset = (uint32_t)(bank - rom_.chr);
+        for (int unit = 0; unit != VRAM_UNIT_COUNT && tag == STATE_BANK_NONE; ++unit) {
+            if (bank < vram_units_[unit] || bank >= vram_units_[unit] + 0x400) continue;
+            tag = unit < 2 ? STATE_BANK_VRAM : STATE_BANK_VRAM_EX;
+            offset = (uint32_t)((unit & 1) * 0x400 + (bank - vram_units_[unit]));
+        }
+        ppu[i] = tag << 24 | offset;
+    }
+}
+
+bool Famicom::CheckBanks(const uint32_t* prg, const uint32_t* ppu) const{
+    const size_t prg_size = 16 * 1024 * rom_.count_16k;
+    const size_t chr_size = 8 * 1024 * rom_.count_8k;
+    for (int i = 0; i != 4; ++i)
+        if ((size_t)prg[i] + 8 * 1024 > prg_size) return false;
+    for (int i = 0; i != 0x4000 / 0x0400; ++i) {
+        const uint32_t offset = ppu[i] & 0xffffff;
+        switch (ppu[i] >> 24) {
+        case STATE_BANK_CHR:
+            if (offset + 0x400 > chr_size) return false;
+            break;
+        case STATE_BANK_VRAM:
+        case STATE_BANK_VRAM_EX:
+            // 2KB each, a bank never straddles the two 1KB units
+            if (offset + 0x400 > 2 * 1024 || (offset & 0x3ff)) return false;
+            break;
+        case STATE_BANK_NONE:
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+void Famicom::DecodeBanks(const uint32_t* prg, const uint32_t* ppu){
+    for (int i = 0; i != 4; ++i) prg_banks_[4 + i] = rom_.prg + prg[i];
+    for (int i = 0; i != 0x4000 / 0x0400; ++i) {
+        const uint32_t offset = ppu[i] & 0xffffff;
+        switch (ppu[i] >> 24) {
+        case STATE_BANK_CHR: ppu_.banks[i] = rom_.chr + offset; break;
+        case STATE_BANK_VRAM: ppu_.banks[i] = vram_units_[offset >> 10]; break;
+        case STATE_BANK_VRAM_EX: ppu_.banks[i] = vram_units_[2 + (offset >> 10)]; break;
+        default: ppu_.banks[i] = nullptr; break;
+        }
+    }
+}
+
+void Famicom::TrackDirty(bool on){
+    tracking_ = on;
+    if (on && !delta_base_) delta_base_ = new uint8_t[DIRTY_COUNT * 0x100 + sizeof(StateRegisters)];
+    if (!on) {
+        delete[] delta_base_;
+        delta_base_ = nullptr;
+    }
+    Rebase();
+    ProtectPages();
+}
+
+void Famicom::ProtectPages(){
+    MapPages(0, 0x20);
+    MapPages(0x60, 0x20);
+}
+
+void Famicom::MarkVram(const uint8_t* bank, uint16_t offset){
+    for (int unit = 0; unit != VRAM_UNIT_COUNT; ++unit) {
+        if (vram_units_[unit] != bank) continue;
+        dirty_ |= (uint64_t)1 << (DIRTY_VRAM + unit * 4 + (offset >> 8));
+        if (offset < 32 * 30) {
+            dirty_tiles_[unit][offset >> 5] |= (uint32_t)1 << (offset & 31);
+            return;
+        }
+        // an attribute byte covers 4x4 tiles
+        const int attr = offset - 32 * 30;
+        const int row = (attr >> 3) * 4;
+        for (int i = row; i != row + 4 && i != 30; ++i)
+            dirty_tiles_[unit][i] |= (uint32_t)0xf << ((attr & 7) * 4);
+        return;
+    }
+}
+
+// Delta records: the unit's dirty bit index (DELTA_REGISTERS for the
+// register block), a span count, then per span the unchanged bytes to skip
+// and the changed bytes that follow, both counted in a byte. Equal runs of
+// up to 2 bytes stay inside a span, a span header costs as much.
+static bool AppendSpans(uint8_t index, const uint8_t* base, const uint8_t* now,
+    size_t length, vector<uint8_t>& out){
+    const size_t start = out.size();
+    out.push_back(index);
+    out.push_back(0);
+    unsigned spans = 0;
+    size_t at = 0;
+    for (size_t i = 0;;) {
+        while (i != length && base[i] == now[i]) ++i;
+        if (i == length) break;
+        size_t skip = i - at;
+        for (; skip > 0xff; skip -= 0xff, ++spans) {
+            out.push_back(0xff);
+            out.push_back(0);
+        }
+        size_t last = i;
+        for (size_t j = i; j != length && j - last <= 2 && j - i < 0xff; ++j)
+            if (base[j] != now[j]) last = j;
+        out.push_back((uint8_t)skip);
+        out.push_back((uint8_t)(last + 1 - i));
+        out.insert(out.end(), now + i, now + last + 1);
+        ++spans;
+        at = i = last + 1;
+    }
+    if (!spans) out.resize(start);
+    else out[start + 1] = (uint8_t)spans;
+    return spans != 0;
+}
+
+// the spans of a record after its index byte, false if they overrun
+// `length` bytes or the input
+static bool CheckSpans(const uint8_t*& p, const uint8_t* end, size_t length){
+    if (p == end) return false;
+    unsigned spans = *p++;
+    size_t at = 0;
+    for (; spans; --spans) {
+        if (end - p < 2) return false;
+        at += p[0] + p[1];
+        if (at > length || (size_t)(end - p) < 2u + p[1]) return false;
+        p += 2 + p[1];
+    }
+    return true;
+}
+
+static void ApplySpans(const uint8_t*& p, uint8_t* out){
+    for (unsigned spans = *p++; spans; --spans) {
+        out += p[0];
+        memcpy(out, p + 2, p[1]);
+        out += p[1];
+        p += 2 + p[1];
+    }
+}
+
+const uint8_t* Famicom::DirtyUnit(int index, size_t& length) const{
+    length = 0x100;
+    if (index < DIRTY_VRAM) return ram_pages_[index];
+    if (index < DIRTY_OAM) return vram_units_[(index - DIRTY_VRAM) >> 2] + (((index - DIRTY_VRAM) & 3) << 8);
+    if (index == DIRTY_OAM) return ppu_.sprites;
+    length = sizeof(ppu_.spindexes);
+    return ppu_.spindexes;
+}
+
+void Famicom::SaveRegisters(StateRegisters& regs) const{
+    memset(&regs, 0, sizeof(regs));
+    regs.cpu = state_;
+    regs.ppu_cycle = ppu_cycle_;
+    regs.frame_base = frame_base_;
+    regs.frame_count = frame_count_;
+    for (int type = 0; type != EVENT_COUNT; ++type) {
+        regs.events[type] = scheduler_.Deadline((uint8_t)type);
+        regs.ppu_events[type] = ppu_events_.Deadline((uint8_t)type);
+    }
+    EncodeBanks(regs.prg_banks, regs.ppu_banks);
+    regs.vramaddr = ppu_.vramaddr;
+    regs.scanline = ppu_.scanline;
+    regs.dot = ppu_.dot;
+    regs.ctrl = ppu_.ctrl;
+    regs.mask = ppu_.mask;
+    regs.status = ppu_.status;
+    regs.oamaddr = ppu_.oamaddr;
+    regs.scroll[0] = ppu_.scroll[0];
+    regs.scroll[1] = ppu_.scroll[1];
+    regs.writex2 = ppu_.writex2;
+    regs.pseudo = ppu_.pseudo;
+    regs.controller1 = controller1_;
+    regs.controller2 = controller2_;
+    regs.controller_status_mask = controller_status_mask_;
+    memcpy(regs.controller_states, controller_states_, sizeof(controller_states_));
+    regs.irq_lines = irq_lines_;
+    regs.dma_page = dma_page_;
+}
+
+void Famicom::LoadRegisters(const StateRegisters& regs){
+    state_ = regs.cpu;
+    ppu_cycle_ = regs.ppu_cycle;
+    frame_base_ = regs.frame_base;
+    frame_count_ = regs.frame_count;
+    scheduler_.Clear();
+    ppu_events_.Clear();
+    for (int type = 0; type != EVENT_COUNT; ++type) {
+        if (regs.events[type] != EVENT_NEVER) scheduler_.Schedule((uint8_t)type, regs.events[type]);
+        if (regs.ppu_events[type] != EVENT_NEVER) ppu_events_.Schedule((uint8_t)type, regs.ppu_events[type]);
+    }
+    DecodeBanks(regs.prg_banks, regs.ppu_banks);
+    ppu_.vramaddr = regs.vramaddr;
+    ppu_.scanline = regs.scanline;
+    ppu_.dot = regs.dot;
+    ppu_.ctrl = regs.ctrl;
+    ppu_.mask = regs.mask;
+    ppu_.status = regs.status;
+    ppu_.oamaddr = regs.oamaddr;
+    ppu_.scroll[0] = regs.scroll[0];
+    ppu_.scroll[1] = regs.scroll[1];
+    ppu_.writex2 = regs.writex2;
+    ppu_.pseudo = regs.pseudo;
+    controller1_ = regs.controller1;
+    controller2_ = regs.controller2;
+    controller_status_mask_ = regs.controller_status_mask;
+    memcpy(controller_states_, regs.controller_states, sizeof(controller_states_));
+    irq_lines_ = regs.irq_lines;
+    dma_page_ = regs.dma_page;
+}
+
+void Famicom::Rebase(){
+    dirty_ = 0;
+    if (!delta_base_) return;
+    for (int i = 0; i != DIRTY_COUNT; ++i) {
+        size_t length;
+        const uint8_t* unit = DirtyUnit(i, length);
+        if (unit) memcpy(delta_base_ + i * 0x100, unit, length);
+    }
+    StateRegisters regs;
+    SaveRegisters(regs);
+    memcpy(delta_base_ + DIRTY_COUNT * 0x100, &regs, sizeof(regs));
+}
+
+void Famicom::SaveDelta(vector<uint8_t>& out){
+    assert(delta_base_ && "SaveDelta needs TrackDirty(true)");
+    out.reserve(sizeof(DeltaHeader) + 0x400);
+    out.resize(sizeof(DeltaHeader));
+    DeltaHeader header;
+    memset(&header, 0, sizeof(header));
+    header.id = DeltaId();
+    header.version = DELTA_VERSION;
+    header.rom_hash = RomHash();
+
+    // registers first, against those of the last snapshot
+    StateRegisters regs;
+    SaveRegisters(regs);
+    uint8_t* const base_regs = delta_base_ + DIRTY_COUNT * 0x100;
+    if (AppendSpans(DELTA_REGISTERS, base_regs, (const uint8_t*)&regs, sizeof(regs), out))
+        ++header.records;
+    memcpy(base_regs, &regs, sizeof(regs));
+    // only dirty units can differ, a unit written back unchanged is skipped
+    for (int i = 0; i != DIRTY_COUNT; ++i) {
+        if (!(dirty_ >> i & 1)) continue;
+        size_t length;
+        const uint8_t* unit = DirtyUnit(i, length);
+        uint8_t* base = delta_base_ + i * 0x100;
+        if (AppendSpans((uint8_t)i, base, unit, length, out)) ++header.records;
+        memcpy(base, unit, length);
+    }
+    memcpy(out.data(), &header, sizeof(header));
+    // next interval
+    dirty_ = 0;
+    ProtectPages();
+}
+
+int Famicom::LoadDelta(const uint8_t* data, size_t size){
+    DeltaHeader header;
+    if (size < sizeof(header)) return ERROR_ILLEGAL_FILE;
+    memcpy(&header, data, sizeof(header));
+    if (header.id != DeltaId() || header.version != DELTA_VERSION) return ERROR_ILLEGAL_FILE;
+    if (header.rom_hash != RomHash()) return ERROR_ROM_MISMATCH;
+    if (forks_) return ERROR_UNSUPPORTED;
+    // validate every record before touching the machine; the registers
+    // are patched on a copy of the current ones
+    StateRegisters regs;
+    SaveRegisters(regs);
+    const uint8_t* const begin = data + sizeof(header);
+    const uint8_t* const end = data + size;
+    const uint8_t* p = begin;
+    for (int n = 0; n != header.records; ++n) {
+        if (p == end || *p > DELTA_REGISTERS) return ERROR_ILLEGAL_FILE;
+        const int i = *p++;
+        if (i >= 8 && i < DIRTY_VRAM && !save_memory_) return ERROR_ILLEGAL_FILE;
+        size_t length = sizeof(regs);
+        if (i != DELTA_REGISTERS) DirtyUnit(i, length);
+        if (i == DELTA_REGISTERS && n != 0) return ERROR_ILLEGAL_FILE;
+        const uint8_t* spans = p;
+        if (!CheckSpans(p, end, length)) return ERROR_ILLEGAL_FILE;
+        if (i == DELTA_REGISTERS) ApplySpans(spans, (uint8_t*)&regs);
+    }
+    if (p != end || !CheckBanks(regs.prg_banks, regs.ppu_banks)) return ERROR_ILLEGAL_FILE;
+
+    LoadRegisters(regs);
+    for (p = begin; p != end;) {
+        const int i = *p++;
+        if (i == DELTA_REGISTERS) {
+            CheckSpans(p, end, sizeof(regs));
+            continue;
+        }
+        uint8_t* unit;
+        if (i < DIRTY_VRAM) unit = WritableRamPage(i < 8 ? i : 0x60 + i - 8);
+        else if (i < DIRTY_OAM) {
+            const int index = (i - DIRTY_VRAM) >> 2;
+            uint8_t* memory = vram_units_[index];
+            if (parent_) memory = WritableVram(memory);
+            unit = memory + (((i - DIRTY_VRAM) & 3) << 8);
+            memset(dirty_tiles_[index], 0xff, sizeof(dirty_tiles_[index]));
+        }
+        else if (i == DIRTY_OAM) unit = ppu_.sprites;
+        else unit = ppu_.spindexes;
+        ApplySpans(p, unit);
+    }
+    MapPages(0, 0x100);
+    UpdateColors();
+    StartRaster();
+    Rebase();
+    ProtectPages();
+    return 0;
+}
+
+int Famicom::SaveStateFile(const string& file) const{
+    vector<uint8_t> data;
+    SaveState(data);
+    ofstream state_of(file, ios::binary | ios::out | ios::trunc);
+    if (!state_of) return ERROR_FILED;
+    state_of.write((const char*)data.data(), data.size());
+    return state_of ? 0 : ERROR_FILED;
+}
+
+int Famicom::ResumeStateFile(const string& file){
+    // mapped rather than read: the page cache serves every session
+    // started from the same snapshot
+    const int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) return ERROR_FILE_NOT_EXIST;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(StateHeader)) {
+        close(fd);
+        return ERROR_ILLEGAL_FILE;
+    }
+    const size_t size = (size_t)info.st_size;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return ERROR_FILED;
+    const int code = LoadState((const uint8_t*)data, size);
+    munmap(data, size);
+    return code;
+}
+
+uint8_t Famicom::ControllerBits(int port) const{
+    assert(port == 0 || port == 1);
+    uint8_t bits = 0;
+    for (int i = 0; i != 8; ++i)
+        if (controller_states_[port * 8 + i]) bits |= (uint8_t)(1 << i);
+    return bits;
+}
+
+void Famicom::SetControllerBits(int port, uint8_t bits){
+    assert(port == 0 || port == 1);
+    for (int i = 0; i != 8; ++i)
+        controller_states_[port * 8 + i] = (bits >> i) & 1;
+}
+
 void Famicom::LoadProgram8k(int des, int src){
     prg_banks_[4 + des] = rom_.prg + 8 * 1024 * src;
+    // bank switch: compare codes are checked against the new bank
+    MapPages((4 + des) << 5, 0x20);
+}
 
+void Famicom::MapPages(int first, int count){
+    for (int page = first; page != first + count; ++page) {
+        uint8_t* memory = nullptr;
+        if (flat_) memory = flat_ + (page << 8);
+        // [$0000,$2000) RAM, mirrored every $800
+        else if (page < 0x20) memory = ram_pages_[page & 0x07];
+        // [$6000,$8000) SRAM
+        else if (page >= 0x60 && page < 0x80) memory = save_memory_ ? ram_pages_[8 + page - 0x60] : nullptr;
+        // [$8000,$10000) PRG-ROM
+        else if (page >= 0x80) memory = prg_banks_[page >> 5] + ((page & 0x1f) << 8);
+        page_map_[page] = memory;
+    }
+    cheats_.Overlay(page_map_, direct_map_, first, count);
+    // watched pages drop to the slow path, where the debugger sees them,
+    // so do pages a fork still shares with its parent
+    for (int page = first; page != first + count; ++page) {
+        const uint8_t watch = watch_pages_[page];
+        const int index = page < 0x20 ? (page & 0x07) : page >= 0x60 && page < 0x80 ? 8 + page - 0x60 : -1;
+        const bool shared = !flat_ && index >= 0 && ram_pages_[index] != OwnRamPage(index);
+        const bool clean = tracking_ && index >= 0 && !(dirty_ >> index & 1);
+        read_map_[page] = unmapped_ || (watch & WATCH_READ) ? nullptr : direct_map_[page];
+        write_map_[page] = page < 0x80 && !unmapped_ && !shared && !clean && !(watch & WATCH_WRITE)
+            ? page_map_[page] : nullptr;
+    }
+}
+
+uint8_t* Famicom::OwnRamPage(int index){
+    if (index < 8) return main_memory_ + (index << 8);
+    return save_memory_ ? save_memory_ + ((index - 8) << 8) : nullptr;
+}
+
+uint8_t* Famicom::OwnVramUnit(int unit){
+    return (unit < 2 ? video_memory_ : video_memory_ex_) + (unit & 1) * 0x400;
+}
+
+uint8_t* Famicom::WritableRamPage(int page){
+    const int index = page < 0x20 ? (page & 0x07) : page >= 0x60 && page < 0x80 ? 8 + page - 0x60 : -1;
+    if (index < 0) return nullptr;
+    uint8_t* const own = OwnRamPage(index);
+    if (!own) return nullptr;
+    const uint64_t bit = (uint64_t)1 << index;
+    const bool shared = ram_pages_[index] != own;
+    const bool clean = tracking_ && !(dirty_ & bit);
+    if (!shared && !clean) return own;
+    if (shared) {
+        memcpy(own, ram_pages_[index], 0x100);
+        ram_pages_[index] = own;
+        ++copied_pages_;
+    }
+    // back on the fast path until the next snapshot
+    if (tracking_) dirty_ |= bit;
+    if (index < 8) for (int mirror = index; mirror < 0x20; mirror += 8) MapPages(mirror, 1);
+    else MapPages(0x60 + index - 8, 1);
+    return own;
+}
+
+uint8_t* Famicom::WritableVram(uint8_t* bank){
+    for (int unit = 0; unit != VRAM_UNIT_COUNT; ++unit) {
+        if (vram_units_[unit] != bank) continue;
+        uint8_t* const own = OwnVramUnit(unit);
+        if (bank == own) return own;
+        memcpy(own, bank, 0x400);
+        vram_units_[unit] = own;
+        ++copied_pages_;
+        // every mirror of the nametable follows
+        for (int i = 8; i != 0x10; ++i) if (ppu_.banks[i] == bank) ppu_.banks[i] = own;
+        return own;
+    }
+    return bank;
+}
+
+void Famicom::GatherRam(uint8_t* out) const{
+    for (int i = 0; i != 8; ++i) memcpy(out + (i << 8), ram_pages_[i], 0x100);
+}
+
+void Famicom::GatherVram(uint8_t* out) const{
+    for (int i = 0; i != VRAM_UNIT_COUNT; ++i) memcpy(out + i * 0x400, vram_units_[i], 0x400);
+}
+
+void Famicom::Release(){
+    if (!parent_) return;
+    --parent_->forks_;
+    parent_ = nullptr;
+}
+
+int Famicom::Fork(Famicom& child){
+    if (&child == this || child.forks_ || !loaded_) return ERROR_UNSUPPORTED;
+    child.Release();
+    child.rom_ = rom_;
+    child.rom_data_ = rom_data_;
+    child.rom_hash_ = rom_hash_;
+    child.loaded_ = true;
+    if (save_memory_ && !child.save_memory_) child.save_memory_ = new uint8_t[8 * 1024];
+    if (!save_memory_) {
+        delete[] child.save_memory_;
+        child.save_memory_ = nullptr;
+    }
+    // pages are shared, not copied
+    memcpy(child.ram_pages_, ram_pages_, sizeof(ram_pages_));
+    memcpy(child.vram_units_, vram_units_, sizeof(vram_units_));
+    memset(child.dirty_tiles_, 0xff, sizeof(child.dirty_tiles_));
+    memcpy(child.prg_banks_, prg_banks_, sizeof(prg_banks_));
+    child.prg_banks_[0] = child.main_memory_;
+    child.prg_banks_[3] = child.save_memory_;
+
+    child.state_ = state_;
+    child.ppu_ = ppu_;
+    child.UpdateColors();
+    child.StartRaster();
+    child.controller1_ = controller1_;
+    child.controller2_ = controller2_;
+    child.controller_status_mask_ = controller_status_mask_;
+    memcpy(child.controller_states_, controller_states_, sizeof(controller_states_));
+    child.scheduler_ = scheduler_;
+    child.ppu_events_ = ppu_events_;
+    child.ppu_cycle_ = ppu_cycle_;
+    child.frame_base_ = frame_base_;
+    child.frame_count_ = frame_count_;
+    child.frame_done_ = frame_done_;
+    child.irq_lines_ = irq_lines_;
+    child.dma_page_ = dma_page_;
+    child.cheats_ = cheats_;
+    child.parent_ = this;
+    child.copied_pages_ = 0;
+    ++forks_;
+    child.MapPages(0, 0x100);
+    return 0;
+}
+
+void Famicom::AttachCdl(CodeDataLog* cdl){
+    cdl_ = cdl;
+    if (cdl) cdl->Init(16 * 1024 * rom_.count_16k, 8 * 1024 * rom_.count_8k);
+}
+
+void Famicom::LogTiles(){
+    // CHR-RAM has nothing to log
+    if (!rom_.count_8k) return;
+    const uint8_t* const chr_end = rom_.chr + 8 * 1024 * rom_.count_8k;
+    auto tile = [this, chr_end](uint16_t address){
+        const uint8_t* p = ppu_.banks[address >> 10] + (address & (uint16_t)0x3ff);
+        if (p >= rom_.chr && p < chr_end) cdl_->Tile((size_t)(p - rom_.chr), CDL_DRAWN);
+    };
+    if (ppu_.mask & (uint8_t)PPU2001_Back) {
+        const uint16_t table = (ppu_.ctrl & PPU2000_BgTabl) ? 0x1000 : 0;
+        for (int nt = 0; nt != 4; ++nt) {
+            const uint8_t* names = ppu_.banks[8 + nt];
+            for (int i = 0; i != 32 * 30; ++i) tile(table | (uint16_t)names[i] << 4);
+        }
+    }
+    if (ppu_.mask & (uint8_t)PPU2001_Sprite) {
+        for (int i = 0; i != 64; ++i) {
+            const uint8_t* sprite = ppu_.sprites + i * 4;
+            // $EF and below are on screen
+            if (sprite[0] >= 0xEF) continue;
+            const uint8_t index = sprite[1];
+            if (ppu_.ctrl & PPU2000_Sp8x16) {
+                const uint16_t table = (index & 1) ? 0x1000 : 0;
+                tile(table | (uint16_t)(index & 0xfe) << 4);
+                tile(table | (uint16_t)(index | 1) << 4);
+            }
+            else tile(((ppu_.ctrl & PPUFLAG_SpTabl) ? 0x1000 : 0) | (uint16_t)index << 4);
+        }
+    }
+}
+
+int Famicom::AddCheat(const string& code){
+    const int result = cheats_.Add(code);
+    if (result) return result;
+    MapPages(0x80, 0x80);
+    FreezeCheats();
+    return 0;
+}
+
+// through WritableRamPage, so a fork copies the page and tracking sees it
+void Famicom::FreezeCheats(){
+    cheats_.Freeze([this](int page){ return flat_ ? flat_ + (page << 8) : WritableRamPage(page); });
+}
+
+void Famicom::ClearCheats(){
+    cheats_.Clear();
+    MapPages(0x80, 0x80);
 }
 void Famicom::LoadChrrom1k(int des, int src){
+    // pattern data is observable from here on
+    SyncPPU();
     ppu_.banks[des] = rom_.chr + 1024 * src;
 }
 
@@ -104,40 +927,41 @@ int Famicom::ResetMapper00(){
 void Famicom::SetupNametableBank(){
     // 4屏
     if (rom_.four_screen) {
-        ppu_.banks[0x8] = video_memory_ + 0x400 * 0;
-        ppu_.banks[0x9] = video_memory_ + 0x400 * 1;
-        ppu_.banks[0xa] = video_memory_ex_ + 0x400 * 0;
-        ppu_.banks[0xb] = video_memory_ex_ + 0x400 * 1;
+        ppu_.banks[0x8] = vram_units_[0];
+        ppu_.banks[0x9] = vram_units_[1];
+        ppu_.banks[0xa] = vram_units_[2];
+        ppu_.banks[0xb] = vram_units_[3];
     }
     // 横版
     else if (rom_.vmirroring) {
-        ppu_.banks[0x8] = video_memory_ + 0x400 * 0;
-        ppu_.banks[0x9] = video_memory_ + 0x400 * 1;
-        ppu_.banks[0xa] = video_memory_ + 0x400 * 0;
-        ppu_.banks[0xb] = video_memory_ + 0x400 * 1;
+        ppu_.banks[0x8] = vram_units_[0];
+        ppu_.banks[0x9] = vram_units_[1];
+        ppu_.banks[0xa] = vram_units_[0];
+        ppu_.banks[0xb] = vram_units_[1];
     }
     // 纵版
     else {
-        ppu_.banks[0x8] = video_memory_ + 0x400 * 0;
-        ppu_.banks[0x9] = video_memory_ + 0x400 * 0;
-        ppu_.banks[0xa] = video_memory_ + 0x400 * 1;
-        ppu_.banks[0xb] = video_memory_ + 0x400 * 1;
+        ppu_.banks[0x8] = vram_units_[0];
+        ppu_.banks[0x9] = vram_units_[0];
+        ppu_.banks[0xa] = vram_units_[1];
+        ppu_.banks[0xb] = vram_units_[1];
     }
 }
 int Famicom::Reset(){
     // only support mapper 000 for now
     auto code = ResetMapper00();
     if(code != 0) return code;
+    MapPages(0, 0x100);
 
-    const uint8_t pcl = cpu_->Read(CPU_RESET + 0);
-    const uint8_t pch = cpu_->Read(CPU_RESET + 1);
+    const uint8_t pcl = cpu_.Read(CPU_RESET + 0);
+    const uint8_t pch = cpu_.Read(CPU_RESET + 1);
 
-    registers_.programCounter = (uint16_t)pcl | (uint16_t)pch << 8;
-    registers_.accumulator = 0;
-    registers_.xIndex = 0;
-    registers_.yIndex = 0;
-    registers_.stackPointer = 0xfd;
-    registers_.status = 0x34 | FLAG_R;
+    state_.registers.programCounter = (uint16_t)pcl | (uint16_t)pch << 8;
+    state_.registers.accumulator = 0;
+    state_.registers.xIndex = 0;
+    state_.registers.yIndex = 0;
+    state_.registers.stackPointer = 0xfd;
+    state_.registers.SetStatus(0x34 | FLAG_R);
 
     SetupNametableBank();
 
@@ -146,8 +970,24 @@ int Famicom::Reset(){
     ppu_.banks[0xe] = ppu_.banks[0xa];
     ppu_.banks[0xf] = ppu_.banks[0xb];
 
+    // timing, frame starts at scanline 0
+    state_.cycle = 0;
+    ppu_cycle_ = 0;
+    frame_base_ = 0;
+    frame_count_ = 0;
+    irq_lines_ = 0;
+    ppu_.scanline = 0;
+    ppu_.dot = 0;
+    scheduler_.Clear();
+    scheduler_.Schedule(EVENT_FRAME_END, MASTER_PER_FRAME);
+    // the frame counter powers up in 4-step mode with its IRQ enabled
+    scheduler_.Schedule(EVENT_APU_FRAME_IRQ, (uint64_t)APU_FRAME_PERIOD * MASTER_PER_CPU);
+    ppu_events_.Clear();
+    ppu_events_.Schedule(EVENT_VBLANK_START, LINE_VBLANK * MASTER_PER_LINE + MASTER_PER_DOT);
+    ppu_events_.Schedule(EVENT_VBLANK_END, LINE_PRERENDER * MASTER_PER_LINE + MASTER_PER_DOT);
+
     // for testrom (nestest.nes)
-    //registers_.programCounter = 0xC000;
+    //state_.registers.programCounter = 0xC000;
 
     return 0;
 }
@@ -161,6 +1001,8 @@ uint8_t Famicom::ReadPPU(uint16_t address){
         assert(ppu_.banks[index]);
         const uint8_t data = ppu_.pseudo;
         ppu_.pseudo = ppu_.banks[index][offset];
+        if (cdl_ && realAddress < 0x2000 && rom_.count_8k)
+            cdl_->Chr((size_t)(ppu_.banks[index] + offset - rom_.chr), CDL_READ);
         return data;
     }
     // palette
@@ -174,27 +1016,179 @@ void Famicom::WritePPU(uint16_t address, uint8_t data){
         const uint16_t index = realAddress >> 10;
         const uint16_t offset = realAddress & (uint16_t)0x3FF;
         assert(ppu_.banks[index]);
-        ppu_.banks[index][offset] = data;
+        uint8_t* bank = ppu_.banks[index];
+        if (parent_) bank = WritableVram(bank);
+        bank[offset] = data;
+        MarkVram(bank, offset);
     }
     else {
+        dirty_ |= (uint64_t)1 << DIRTY_PALETTE;
+        LogRaster((uint8_t)(RASTER_PALETTE | (realAddress & 0x1f)), data);
         // 独立地址
         if (realAddress & (uint16_t)0x03) {
-            ppu_.spindexes[realAddress & (uint16_t)0x1f] = data;
+            const int index = realAddress & 0x1f;
+            ppu_.spindexes[index] = data;
+            palette_colors_[index] = ShownColor(palette_lut_, ppu_.spindexes, ppu_.mask, index);
         }
         // $3F00/$3F04/$3F08/$3F0C
         else {
             const uint16_t offset = realAddress & (uint16_t)0x0f;
             ppu_.spindexes[offset] = data;
             ppu_.spindexes[offset | (uint16_t)0x10] = data;
+            // only the backdrop is shown, in every 4th entry
+            if (!offset) {
+                const uint32_t color = ShownColor(palette_lut_, ppu_.spindexes, ppu_.mask, 0);
+                for (int i = 0; i != 0x20; i += 4) palette_colors_[i] = color;
+            }
         }
     }
 }
+// a frame starts with the current registers and no raster writes
+void Famicom::StartRaster(){
+    raster_start_.ctrl = ppu_.ctrl;
+    raster_start_.mask = ppu_.mask;
+    raster_start_.scroll[0] = ppu_.scroll[0];
+    raster_start_.scroll[1] = ppu_.scroll[1];
+    memcpy(raster_start_.spindexes, ppu_.spindexes, sizeof(raster_start_.spindexes));
+    memcpy(raster_start_.colors, palette_colors_, sizeof(raster_start_.colors));
+    raster_count_ = 0;
+}
+void Famicom::UpdateColors(){
+    for (int i = 0; i != 0x20; ++i)
+        palette_colors_[i] = ShownColor(palette_lut_, ppu_.spindexes, ppu_.mask, i);
+}
+void Famicom::SetPixelFormat(int format){
+    assert(format >= 0 && format < PIXEL_FORMAT_COUNT);
+    palette_lut_ = PaletteLut(format);
+    UpdateColors();
+}
 
 void Famicom::sVblank(){
     ppu_.status |= (uint8_t)PPU2002_VBlank;
 }
 
 void Famicom::eVblank(){
-    ppu_.status &= ~(uint8_t)PPU2002_VBlank;
+    ppu_.status &= ~(uint8_t)(PPU2002_VBlank | PPU2002_Sp0Hit | PPU2002_SpOver);
+}
+
+void Famicom::Schedule(uint8_t type, uint64_t cycle){
+    scheduler_.Schedule(type, cycle);
+    // cut the running block short
+    if (cycle < state_.deadline) state_.deadline = cycle;
+}
+
+void Famicom::ScheduleMapperIRQ(uint64_t cycle){
+    Schedule(EVENT_MAPPER_IRQ, cycle);
+}
+
+void Famicom::AcknowledgeIRQ(uint8_t lines){
+    irq_lines_ &= ~lines;
+    if (lines & IRQ_MAPPER) scheduler_.Cancel(EVENT_MAPPER_IRQ);
+}
+
+void Famicom::ScheduleSprite0(uint64_t frame_base){
+    // OAM Y is one line early
+    const unsigned y = (unsigned)ppu_.sprites[0] + 1;
+    const unsigned x = ppu_.sprites[3];
+    if (y >= 240) {
+        ppu_events_.Cancel(EVENT_SPRITE0_HIT);
+        return;
+    }
+    ppu_events_.Schedule(EVENT_SPRITE0_HIT,
+        frame_base + y * MASTER_PER_LINE + (x + 1) * MASTER_PER_DOT);
+}
+
+void Famicom::ScheduleNMI(){
+    // the only PPU milestone the cpu has to stop for
+    if (ppu_.ctrl & (uint8_t)PPU2000_NMIGen)
+        Schedule(EVENT_NMI, ppu_events_.Deadline(EVENT_VBLANK_START));
+    else
+        scheduler_.Cancel(EVENT_NMI);
+}
+
+void Famicom::SyncPPU(){
+    // catch the PPU up to the current cpu cycle
+    if (ppu_cycle_ >= state_.cycle) return;
+    Event event;
+    while (ppu_events_.Pop(state_.cycle, event)) DispatchPPU(event);
+    ppu_cycle_ = state_.cycle;
+    const uint64_t offset = (state_.cycle - frame_base_) % MASTER_PER_FRAME;
+    ppu_.scanline = (uint16_t)(offset / MASTER_PER_LINE);
+    ppu_.dot = (uint16_t)(offset % MASTER_PER_LINE / MASTER_PER_DOT);
+}
+
+void Famicom::DispatchPPU(const Event& event){
+    switch (event.type) {
+    case EVENT_VBLANK_START:
+        sVblank();
+        ppu_events_.Schedule(EVENT_VBLANK_START, event.cycle + MASTER_PER_FRAME);
+        break;
+    case EVENT_VBLANK_END:
+        eVblank();
+        ScheduleSprite0(frame_base_ + MASTER_PER_FRAME);
+        ppu_events_.Schedule(EVENT_VBLANK_END, event.cycle + MASTER_PER_FRAME);
+        break;
+    case EVENT_SPRITE0_HIT:
+        // approximated by sprite #0 position, needs both layers on
+        if ((ppu_.mask & (uint8_t)(PPU2001_Back | PPU2001_Sprite))
+            == (uint8_t)(PPU2001_Back | PPU2001_Sprite))
+            ppu_.status |= (uint8_t)PPU2002_Sp0Hit;
+        break;
+    }
+}
+
+void Famicom::Dispatch(const Event& event){
+    switch (event.type) {
+    case EVENT_NMI:
+        SyncPPU();
+        cpu_.NMI();
+        ScheduleNMI();
+        break;
+    case EVENT_MAPPER_IRQ:
+        irq_lines_ |= (uint8_t)IRQ_MAPPER;
+        break;
+    case EVENT_APU_FRAME_IRQ:
+        irq_lines_ |= (uint8_t)IRQ_APU_FRAME;
+        scheduler_.Schedule(EVENT_APU_FRAME_IRQ,
+            event.cycle + (uint64_t)APU_FRAME_PERIOD * MASTER_PER_CPU);
+        break;
+    case EVENT_DMA:
+    {
+        // OAM DMA: 256 bytes from $XX00, cpu halts 513(+1 on odd cycle) cycles
+        SyncPPU();
+        const uint16_t base = (uint16_t)dma_page_ << 8;
+        for (int i = 0; i != 256; ++i)
+            ppu_.sprites[(uint8_t)(ppu_.oamaddr + i)] = cpu_.Read(base + i);
+        dirty_ |= (uint64_t)1 << DIRTY_OAM;
+        const uint64_t odd = (state_.cycle / MASTER_PER_CPU) & 1;
+        state_.cycle += (513 + odd) * MASTER_PER_CPU;
+        break;
+    }
+    case EVENT_FRAME_END:
+        SyncPPU();
+        if (cdl_) LogTiles();
+        frame_base_ += MASTER_PER_FRAME;
+        ++frame_count_;
+        frame_done_ = true;
+        scheduler_.Schedule(EVENT_FRAME_END, event.cycle + MASTER_PER_FRAME);
+        break;
+    }
+}
+
+void Famicom::RunFrame(){
+    assert(!forks_ && "a machine with forks is read-only");
+    frame_done_ = false;
+    StartRaster();
+    FreezeCheats();
+    while (!frame_done_) {
+        // run until the next deadline without checking anything else
+        state_.deadline = scheduler_.NextDeadline();
+        cpu_.Run();
+        Event event;
+        while (scheduler_.Pop(state_.cycle, event)) Dispatch(event);
+        // IRQ is level triggered
+        if (irq_lines_ && !(state_.registers.status & (uint8_t)FLAG_I))
+            cpu_.IRQ();
+    }
 }
 
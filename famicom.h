@@ -2,10 +2,20 @@
 #define SFCE_FAMICOM_H_
 #include <cstdint>
 #include <string>
+#include <vector>
+#include <memory>
 #include "code.h"
 #include "cpu.h"
+#include "scheduler.h"
+#include "cheat.h"
+#include "debugger.h"
+#include "cdl.h"
+#include "palette.h"
 using namespace std;
 
+struct RenderInputs;
+struct StateRegisters;
+
 struct Rom
 {
     // PRG-ROM
@@ -41,6 +51,9 @@ struct PPU
     uint8_t  pseudo;
     uint8_t  spindexes[0x20];
     uint8_t  sprites[0x100];
+    // position the PPU has been caught up to
+    uint16_t scanline;
+    uint16_t dot;
 };
 // ppu flag
 enum
@@ -50,52 +63,271 @@ enum
     PPU2000_BgTabl  = 0x10, // [0x2000]背景调色板表地址$1000(1), $0000(0)
     PPUFLAG_SpTabl  = 0x08, // [0x2000]精灵调色板表地址$1000(1), $0000(0), 8x16模式下被忽略
     PPU2000_VINC32  = 0x04, // [0x2000]VRAM读写增加值32(1), 1(0)
+
+    PPU2001_Emphasis= 0xE0, // [0x2001]强调红/绿/蓝
+    PPU2001_Sprite  = 0x10, // [0x2001]显示精灵
+    PPU2001_Back    = 0x08, // [0x2001]显示背景
+    PPU2001_Grey    = 0x01, // [0x2001]灰阶
         
     PPU2002_VBlank  = 0x80, // [0x2002]垂直空白间隙标志
     PPU2002_Sp0Hit  = 0x40, // [0x2002]零号精灵命中标志
     PPU2002_SpOver  = 0x20, // [0x2002]精灵溢出标志
 };
 
+// raster effects: PPU writes made while lines 0-239 are drawn
+enum
+{
+    RASTER_CTRL     = 0,    // $2000
+    RASTER_MASK,            // $2001
+    RASTER_SCROLL_X,        // $2005, first write
+    RASTER_SCROLL_Y,        // $2005, second write
+    RASTER_PALETTE  = 0x20, // | palette entry ($3F00-$3F1F)
+
+    RASTER_LOG_MAX  = 128,  // writes per frame, later ones are dropped
+};
+struct RasterWrite
+{
+    uint16_t dot;
+    uint8_t  scanline;
+    uint8_t  reg;           // RASTER_XXX
+    uint8_t  value;
+};
+// registers the frame started with
+struct RasterState
+{
+    uint8_t  ctrl;
+    uint8_t  mask;
+    uint8_t  scroll[2];
+    uint8_t  spindexes[0x20];
+    // shown colour of each entry, see Famicom::SetPixelFormat
+    uint32_t colors[0x20];
+};
+
+// irq lines
+enum
+{
+    IRQ_MAPPER      = 0x01, // Mapper中断
+    IRQ_APU_FRAME   = 0x02, // APU帧计数器中断
+};
+// copy-on-write units
+enum
+{
+    RAM_PAGE_COUNT  = 8 + 32,   // 2KB RAM, then 8KB SRAM, in 256-byte pages
+    VRAM_UNIT_COUNT = 4,        // 4KB VRAM in 1KB nametables
+};
+// dirty bits, one per 256-byte page of writable memory
+static const int      DIRTY_VRAM    = RAM_PAGE_COUNT;               // 16 VRAM pages
+static const int      DIRTY_OAM     = DIRTY_VRAM + 16;
+static const int      DIRTY_PALETTE = DIRTY_OAM + 1;                // 32 bytes
+static const int      DIRTY_COUNT   = DIRTY_PALETTE + 1;
+// APU frame counter IRQ period in CPU cycles (4-step mode)
+static const uint32_t APU_FRAME_PERIOD = 29830;
+
 class Famicom
 {
 private:
+    /* hot cpu state, kept ahead of the memory arrays */
+    CpuState state_;
+
+    /* cpu memory map, one entry per 256-byte page */
+    // what the cpu reads, null for I/O and watched pages (slow path)
+    const uint8_t* read_map_[0x100];
+    // what the cpu writes, null for I/O, ROM and watched pages (slow path)
+    uint8_t*   write_map_[0x100];
+    // the memory backing each page, before cheats
+    uint8_t*   page_map_[0x100];
+    // what the page reads as with cheats, before watchpoints
+    const uint8_t* direct_map_[0x100];
+    // WATCH_READ / WATCH_WRITE set by the debugger
+    uint8_t    watch_pages_[0x100];
+    // DiffHarness: every page on the slow path, so all accesses are seen
+    bool       unmapped_ = false;
+    // DiffHarness sandbox, 64KB of plain memory behind every page
+    uint8_t*   flat_ = nullptr;
+    CheatEngine cheats_;
+
     /* physical parts */
     Rom rom_;
+    // owns PRG+CHR, shared by every instance made from the same load
+    shared_ptr<uint8_t> rom_data_;
+    // of PRG+CHR, every snapshot carries it
+    uint64_t rom_hash_ = 0;
     
     uint8_t*   prg_banks_[0x10000 >> 13];
-    uint8_t    save_memory_[8 * 1024];
+    // cold, allocated by Init only if the cartridge has SRAM
+    uint8_t*   save_memory_ = nullptr;
     uint8_t    video_memory_[2 * 1024];
     uint8_t    video_memory_ex_[2 * 1024];
     uint8_t    main_memory_[2 * 1024];
 
+    /* copy-on-write, see Fork() */
+    // memory currently behind each RAM/SRAM page and VRAM unit: the arrays
+    // above, or the parent's memory until the first write
+    uint8_t*   ram_pages_[RAM_PAGE_COUNT];
+    uint8_t*   vram_units_[VRAM_UNIT_COUNT];
+    // the machine this one was forked from, and how many forks this has
+    Famicom*   parent_ = nullptr;
+    int        forks_ = 0;
+    uint32_t   copied_pages_ = 0;
+
+    /* dirty pages since the last snapshot, see SaveDelta() */
+    // clean RAM pages are kept off the write map, so the first write
+    // to each takes the slow path once and marks it
+    bool       tracking_ = false;
+    uint64_t   dirty_ = 0;
+    // while tracking, every dirty unit (256 bytes apart) and the register
+    // block as of the last snapshot; deltas store only what changed since
+    uint8_t*   delta_base_ = nullptr;
+    // background tiles written since the last CaptureRenderInputs,
+    // a bit per 8x8 tile, 30 rows of 32 per VRAM unit
+    uint32_t   dirty_tiles_[VRAM_UNIT_COUNT][30];
+    // raster effects of the running frame, see CaptureRenderInputs
+    RasterState raster_start_;
+    RasterWrite raster_log_[RASTER_LOG_MAX];
+    uint16_t   raster_count_ = 0;
+    // colours in the output format, kept current by WritePPU and $2001
+    const uint32_t* palette_lut_;
+    uint32_t   palette_colors_[0x20];
+
     /* registers and status */
     bool loaded_ = false;
-    CpuRegister registers_;
     uint16_t controller1_;
     uint16_t controller2_;
     uint16_t controller_status_mask_;
     uint8_t  controller_states_[16];
 
+    /* timing */
+    // events that interrupt the cpu (NMI, IRQ, DMA, frame end)
+    Scheduler scheduler_;
+    // PPU milestones, only resolved when the PPU is synchronized
+    Scheduler ppu_events_;
+    // master cycle the PPU has been caught up to
+    uint64_t ppu_cycle_ = 0;
+    // master cycle the current frame started at
+    uint64_t frame_base_ = 0;
+    uint64_t frame_count_ = 0;
+    bool     frame_done_ = false;
+    uint8_t  irq_lines_ = 0;
+    uint8_t  dma_page_ = 0;
+
+    void Dispatch(const Event&);
+    void DispatchPPU(const Event&);
+    void ScheduleSprite0(uint64_t frame_base);
+    void ScheduleNMI();
+    void MapPages(int first, int count);
+    void LogTiles();
+    int PowerOn();
+    uint8_t* OwnRamPage(int index);
+    uint8_t* OwnVramUnit(int unit);
+    // backing page of a RAM/SRAM cpu page, copied first if still shared
+    uint8_t* WritableRamPage(int page);
+    uint8_t* WritableVram(uint8_t* bank);
+    void FreezeCheats();
+    void MarkVram(const uint8_t* bank, uint16_t offset);
+    void LogRaster(uint8_t reg, uint8_t value){
+        // PPU is synced by the caller
+        if (ppu_.scanline >= 240 || raster_count_ == RASTER_LOG_MAX) return;
+        RasterWrite& write = raster_log_[raster_count_++];
+        write.dot = ppu_.dot;
+        write.scanline = (uint8_t)ppu_.scanline;
+        write.reg = reg;
+        write.value = value;
+    }
+    void UpdateColors();
+    void StartRaster();
+    void EncodeBanks(uint32_t* prg, uint32_t* ppu) const;
+    bool CheckBanks(const uint32_t* prg, const uint32_t* ppu) const;
+    void DecodeBanks(const uint32_t* prg, const uint32_t* ppu);
+    void ProtectPages();
+    const uint8_t* DirtyUnit(int index, size_t& length) const;
+    void SaveRegisters(StateRegisters& regs) const;
+    void LoadRegisters(const StateRegisters& regs);
+    // the current state becomes the base of the next delta
+    void Rebase();
+    void GatherRam(uint8_t* out) const;
+    void GatherVram(uint8_t* out) const;
+    void Release();
+
     /* set friend class */
     friend class Cpu;
     friend class Addressing;
     friend class Operation;
+    friend class Debugger;
+    friend class DiffHarness;
+    friend class ObservationRenderer;
+    friend void CaptureRenderInputs(Famicom& fc, RenderInputs& inputs);
+    friend void RenderIndices(const Famicom& fc, uint8_t* indices);
     friend void UserInput(int index, unsigned char data);
 public:
-    Cpu *cpu_;
+    Cpu cpu_;
     PPU ppu_;
+    // attached code/data logger, or null
+    CodeDataLog* cdl_ = nullptr;
+    Famicom();
+    ~Famicom();
     int Init(string romfile);
+    // power on with the ROM of an initialized instance, shared not copied
+    int Init(const Famicom& source);
     int LoadRom(string romfile);
     void ShowInfo();
     void LoadProgram8k(int des, int src);
     void LoadChrrom1k(int des, int src);
+    // sizes the log for this ROM and starts logging into it, null stops
+    void AttachCdl(CodeDataLog* cdl);
+    // PRG-ROM byte behind a cpu address, false outside [$8000,$10000)
+    bool PrgOffset(uint16_t address, size_t& offset) const {
+        if (address < 0x8000) return false;
+        offset = (size_t)(prg_banks_[address >> 13] + (address & (uint16_t)0x1fff) - rom_.prg);
+        return true;
+    }
+    // Game Genie or raw "AAAA:VV" / "AAAA?CC:VV" code
+    int AddCheat(const string& code);
+    void ClearCheats();
     int Reset();
     int ResetMapper00();
     void SetupNametableBank();
     uint8_t ReadPPU(uint16_t);
     void WritePPU(uint16_t, uint8_t);
+    // PIXEL_XXX the renderer gets palette colours in, RGBA by default
+    void SetPixelFormat(int format);
     void sVblank();
     void eVblank();
+    void SyncPPU();
+    void Schedule(uint8_t type, uint64_t cycle);
+    void ScheduleMapperIRQ(uint64_t cycle);
+    void AcknowledgeIRQ(uint8_t lines);
+    void RunFrame();
+    uint64_t RomHash() const;
+    // registers, RAM, VRAM, palette and OAM
+    uint64_t StateHash() const;
+    // controller as a bitmask, bit i = button i
+    uint8_t ControllerBits(int port) const;
+    void SetControllerBits(int port, uint8_t bits);
+    // snapshot of the whole machine at a frame boundary, see StateHeader
+    void SaveState(vector<uint8_t>& out) const;
+    int LoadState(const uint8_t* data, size_t size);
+    int SaveStateFile(const string& file) const;
+    // maps the file and restores it, the ROM must be the same
+    int ResumeStateFile(const string& file);
+    // Makes `child` a copy of this machine that shares RAM, SRAM and VRAM
+    // with it copy-on-write. This machine is read-only (no RunFrame, no
+    // LoadState) until its forks are destroyed or forked again from
+    // elsewhere, so children must not outlive it.
+    int Fork(Famicom& child);
+    // Incremental snapshots: with tracking on, SaveDelta() writes the
+    // register and memory bytes that changed since the previous snapshot,
+    // full or incremental, and starts the next interval. Only pages written
+    // in the interval are compared. LoadDelta() applies one on top of the
+    // state it was taken after.
+    void TrackDirty(bool on);
+    void SaveDelta(vector<uint8_t>& out);
+    int LoadDelta(const uint8_t* data, size_t size);
+    // RAM pages and VRAM units copied since the last Fork() into this one
+    uint32_t CopiedPages() const { return copied_pages_; }
+    // heap memory owned by this instance alone (SRAM), the ROM is shared
+    size_t PrivateHeapSize() const { return save_memory_ ? 8 * 1024 : 0; }
+    uint64_t Cycle() const { return state_.cycle; }
+    uint64_t FrameCount() const { return frame_count_; }
 };
 
 struct NesHeader{
@@ -107,5 +339,15 @@ struct NesHeader{
     uint8_t     reserved[8];
 };
 
+// save-state: this header followed by `state_size` bytes of machine
+// state in the native layout of the build that wrote it
+struct StateHeader{
+    uint32_t    id;             // "SFCS"
+    uint16_t    version;
+    uint16_t    header_size;
+    uint64_t    rom_hash;
+    uint32_t    state_size;
+    uint32_t    reserved;
+};
 
 #endif
\ No newline at end of file
@@ -0,0 +1,286 @@
+#include "filter.h"
+#include "code.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// RGBA in memory order, alpha is the high byte
+static const uint32_t ALPHA = 0xff000000;
+// RGB aperture mask: each column keeps one channel at full strength and
+// loses a quarter of the other two
+static const uint32_t APERTURE[3] = { 0x00ffff00, 0x00ff00ff, 0x0000ffff };
+
+// source row with its edge pixels repeated, [-1, 256]
+static inline void PadRow(const uint32_t* in, uint32_t* row){
+    memcpy(row + 1, in, 256 * sizeof(uint32_t));
+    row[0] = in[0];
+    row[257] = in[255];
+}
+
+// one source row, `scale` times wider
+static void ExpandRow(const uint32_t* in, uint32_t* out, int scale){
+    int x = 0;
+#ifdef __SSE2__
+    if (scale == 2 || scale == 3 || scale == 4) {
+        for (; x != 256; x += 4, out += 4 * scale) {
+            const __m128i p = _mm_loadu_si128((const __m128i*)(in + x));
+            if (scale == 2) {
+                _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi32(p, p));
+                _mm_storeu_si128((__m128i*)(out + 4), _mm_unpackhi_epi32(p, p));
+            }
+            else if (scale == 3) {
+                _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi32(p, _MM_SHUFFLE(1, 0, 0, 0)));
+                _mm_storeu_si128((__m128i*)(out + 4), _mm_shuffle_epi32(p, _MM_SHUFFLE(2, 2, 1, 1)));
+                _mm_storeu_si128((__m128i*)(out + 8), _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 2)));
+            }
+            else {
+                _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi32(p, _MM_SHUFFLE(0, 0, 0, 0)));
+                _mm_storeu_si128((__m128i*)(out + 4), _mm_shuffle_epi32(p, _MM_SHUFFLE(1, 1, 1, 1)));
+                _mm_storeu_si128((__m128i*)(out + 8), _mm_shuffle_epi32(p, _MM_SHUFFLE(2, 2, 2, 2)));
+                _mm_storeu_si128((__m128i*)(out + 12), _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 3)));
+            }
+        }
+        return;
+    }
+#endif
+    for (; x != 256; ++x)
+        for (int i = 0; i != scale; ++i) *out++ = in[x];
+}
+
+// aperture mask over a CRT row, `dim` also halves it for the scanline gap
+static void MaskRow(const uint32_t* in, uint32_t* out, int width, bool dim){
+    int x = 0;
+#ifdef __SSE2__
+    // the mask repeats every 12 pixels, 3 vectors
+    __m128i masks[3];
+    for (int v = 0; v != 3; ++v) {
+        uint32_t lanes[4];
+        for (int i = 0; i != 4; ++i) lanes[i] = APERTURE[(v * 4 + i) % 3] & 0x3f3f3f3f;
+        masks[v] = _mm_loadu_si128((const __m128i*)lanes);
+    }
+    const __m128i half = _mm_set1_epi32(0x7f7f7f7f);
+    const __m128i alpha = _mm_set1_epi32((int)ALPHA);
+    for (int v = 0; x + 4 <= width; x += 4, v = v == 2 ? 0 : v + 1) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(in + x));
+        // a quarter of each masked channel, bytes never borrow
+        p = _mm_sub_epi8(p, _mm_and_si128(_mm_srli_epi32(p, 2), masks[v]));
+        if (dim) p = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 1), half), alpha);
+        _mm_storeu_si128((__m128i*)(out + x), p);
+    }
+#endif
+    for (; x != width; ++x) {
+        uint32_t p = in[x];
+        p -= (p >> 2) & 0x3f3f3f3f & APERTURE[x % 3];
+        if (dim) p = ((p >> 1) & 0x7f7f7f7f) | ALPHA;
+        out[x] = p;
+    }
+}
+
+#ifndef __SSE2__
+static inline uint32_t Pick(bool c, uint32_t a, uint32_t b){
+    return c ? a : b;
+}
+#endif
+
+// rows: source rows y-1, y, y+1, padded; out: 2 output rows of 512
+static void Scale2xRow(const uint32_t* const rows[3], uint32_t* out0, uint32_t* out1){
+#ifdef __SSE2__
+    const __m128i ones = _mm_set1_epi32(-1);
+    for (int x = 0; x != 256; x += 4) {
+        const __m128i B = _mm_loadu_si128((const __m128i*)(rows[0] + x + 1));
+        const __m128i D = _mm_loadu_si128((const __m128i*)(rows[1] + x));
+        const __m128i E = _mm_loadu_si128((const __m128i*)(rows[1] + x + 1));
+        const __m128i F = _mm_loadu_si128((const __m128i*)(rows[1] + x + 2));
+        const __m128i H = _mm_loadu_si128((const __m128i*)(rows[2] + x + 1));
+        // B != H && D != F
+        const __m128i c = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi32(B, H), _mm_cmpeq_epi32(D, F)), ones);
+        const __m128i m0 = _mm_and_si128(c, _mm_cmpeq_epi32(D, B));
+        const __m128i m1 = _mm_and_si128(c, _mm_cmpeq_epi32(B, F));
+        const __m128i m2 = _mm_and_si128(c, _mm_cmpeq_epi32(D, H));
+        const __m128i m3 = _mm_and_si128(c, _mm_cmpeq_epi32(H, F));
+        const __m128i e0 = _mm_or_si128(_mm_and_si128(m0, D), _mm_andnot_si128(m0, E));
+        const __m128i e1 = _mm_or_si128(_mm_and_si128(m1, F), _mm_andnot_si128(m1, E));
+        const __m128i e2 = _mm_or_si128(_mm_and_si128(m2, D), _mm_andnot_si128(m2, E));
+        const __m128i e3 = _mm_or_si128(_mm_and_si128(m3, F), _mm_andnot_si128(m3, E));
+        _mm_storeu_si128((__m128i*)(out0 + x * 2), _mm_unpacklo_epi32(e0, e1));
+        _mm_storeu_si128((__m128i*)(out0 + x * 2 + 4), _mm_unpackhi_epi32(e0, e1));
+        _mm_storeu_si128((__m128i*)(out1 + x * 2), _mm_unpacklo_epi32(e2, e3));
+        _mm_storeu_si128((__m128i*)(out1 + x * 2 + 4), _mm_unpackhi_epi32(e2, e3));
+    }
+#else
+    for (int x = 0; x != 256; ++x) {
+        const uint32_t B = rows[0][x + 1], D = rows[1][x], E = rows[1][x + 1];
+        const uint32_t F = rows[1][x + 2], H = rows[2][x + 1];
+        const bool c = B != H && D != F;
+        out0[x * 2] = Pick(c && D == B, D, E);
+        out0[x * 2 + 1] = Pick(c && B == F, F, E);
+        out1[x * 2] = Pick(c && D == H, D, E);
+        out1[x * 2 + 1] = Pick(c && H == F, F, E);
+    }
+#endif
+}
+
+// rows: source rows y-1, y, y+1, padded; out: 3 output rows of 768
+static void Scale3xRow(const uint32_t* const rows[3], uint32_t* const out[3]){
+#ifdef __SSE2__
+    const __m128i ones = _mm_set1_epi32(-1);
+    for (int x = 0; x != 256; x += 4) {
+        const __m128i A = _mm_loadu_si128((const __m128i*)(rows[0] + x));
+        const __m128i B = _mm_loadu_si128((const __m128i*)(rows[0] + x + 1));
+        const __m128i C = _mm_loadu_si128((const __m128i*)(rows[0] + x + 2));
+        const __m128i D = _mm_loadu_si128((const __m128i*)(rows[1] + x));
+        const __m128i E = _mm_loadu_si128((const __m128i*)(rows[1] + x + 1));
+        const __m128i F = _mm_loadu_si128((const __m128i*)(rows[1] + x + 2));
+        const __m128i G = _mm_loadu_si128((const __m128i*)(rows[2] + x));
+        const __m128i H = _mm_loadu_si128((const __m128i*)(rows[2] + x + 1));
+        const __m128i I = _mm_loadu_si128((const __m128i*)(rows[2] + x + 2));
+        const __m128i c = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi32(B, H), _mm_cmpeq_epi32(D, F)), ones);
+        const __m128i db = _mm_and_si128(c, _mm_cmpeq_epi32(D, B));
+        const __m128i bf = _mm_and_si128(c, _mm_cmpeq_epi32(B, F));
+        const __m128i dh = _mm_and_si128(c, _mm_cmpeq_epi32(D, H));
+        const __m128i hf = _mm_and_si128(c, _mm_cmpeq_epi32(H, F));
+        // E != corner
+        const __m128i na = _mm_andnot_si128(_mm_cmpeq_epi32(E, A), ones);
+        const __m128i nc = _mm_andnot_si128(_mm_cmpeq_epi32(E, C), ones);
+        const __m128i ng = _mm_andnot_si128(_mm_cmpeq_epi32(E, G), ones);
+        const __m128i ni = _mm_andnot_si128(_mm_cmpeq_epi32(E, I), ones);
+        const __m128i m[9] = {
+            db,
+            _mm_or_si128(_mm_and_si128(db, nc), _mm_and_si128(bf, na)),
+            bf,
+            _mm_or_si128(_mm_and_si128(db, ng), _mm_and_si128(dh, na)),
+            _mm_setzero_si128(),
+            _mm_or_si128(_mm_and_si128(bf, ni), _mm_and_si128(hf, nc)),
+            dh,
+            _mm_or_si128(_mm_and_si128(dh, ni), _mm_and_si128(hf, ng)),
+            hf,
+        };
+        const __m128i v[9] = { D, B, F, D, E, F, D, H, F };
+        uint32_t e[9][4];
+        for (int i = 0; i != 9; ++i)
+            _mm_storeu_si128((__m128i*)e[i],
+                _mm_or_si128(_mm_and_si128(m[i], v[i]), _mm_andnot_si128(m[i], E)));
+        // interleave the 3x3 blocks of the 4 pixels
+        for (int r = 0; r != 3; ++r) {
+            uint32_t* p = out[r] + x * 3;
+            for (int k = 0; k != 4; ++k, p += 3) {
+                p[0] = e[r * 3][k];
+                p[1] = e[r * 3 + 1][k];
+                p[2] = e[r * 3 + 2][k];
+            }
+        }
+    }
+#else
+    for (int x = 0; x != 256; ++x) {
+        const uint32_t A = rows[0][x], B = rows[0][x + 1], C = rows[0][x + 2];
+        const uint32_t D = rows[1][x], E = rows[1][x + 1], F = rows[1][x + 2];
+        const uint32_t G = rows[2][x], H = rows[2][x + 1], I = rows[2][x + 2];
+        const bool c = B != H && D != F;
+        const bool db = c && D == B, bf = c && B == F, dh = c && D == H, hf = c && H == F;
+        uint32_t* p0 = out[0] + x * 3;
+        uint32_t* p1 = out[1] + x * 3;
+        uint32_t* p2 = out[2] + x * 3;
+        p0[0] = Pick(db, D, E);
+        p0[1] = Pick((db && E != C) || (bf && E != A), B, E);
+        p0[2] = Pick(bf, F, E);
+        p1[0] = Pick((db && E != G) || (dh && E != A), D, E);
+        p1[1] = E;
+        p1[2] = Pick((bf && E != I) || (hf && E != C), F, E);
+        p2[0] = Pick(dh, D, E);
+        p2[1] = Pick((dh && E != I) || (hf && E != G), H, E);
+        p2[2] = Pick(hf, F, E);
+    }
+#endif
+}
+
+int FrameFilter::Init(const string& name, int scale, int threads){
+    bands_.Stop();
+    if (name == "none") kind_ = FILTER_NONE, scale_ = 1;
+    else if (name == "nearest") kind_ = FILTER_NEAREST, scale_ = scale;
+    else if (name == "scale2x") kind_ = FILTER_SCALE2X, scale_ = 2;
+    else if (name == "scale3x") kind_ = FILTER_SCALE3X, scale_ = 3;
+    else if (name == "crt") kind_ = FILTER_CRT, scale_ = scale;
+    else if (name == "ntsc") kind_ = FILTER_NTSC, scale_ = 2;
+    else return ERROR_UNSUPPORTED;
+    if (scale_ < 1 || scale_ > 8 || (kind_ == FILTER_CRT && scale_ < 2)) {
+        kind_ = FILTER_NONE;
+        scale_ = 1;
+        return ERROR_UNSUPPORTED;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > 16) threads = 16;
+    if (kind_ == FILTER_NONE) threads = 1;
+    if (kind_ == FILTER_NTSC && !ntsc_) ntsc_.reset(new NtscFilter(format_));
+    bands_.Start(threads, &FrameFilter::Band, this);
+    return 0;
+}
+
+void FrameFilter::SetPixelFormat(int format){
+    format_ = format;
+    if (ntsc_ && ntsc_->Format() != format) ntsc_.reset(new NtscFilter(format));
+}
+
+void FrameFilter::Band(void* self, int band, int bands){
+    static_cast<FrameFilter*>(self)->Band(band, bands);
+}
+
+void FrameFilter::Band(int band, int bands){
+    const int first = 240 * band / bands;
+    const int last = 240 * (band + 1) / bands;
+    const int width = Width();
+    uint32_t padded[3][258];
+    const uint32_t* rows[3] = { padded[0], padded[1], padded[2] };
+    for (int y = first; y != last; ++y) {
+        const uint32_t* in = in_ + y * 256;
+        uint32_t* out = out_ + (size_t)y * scale_ * width;
+        switch (kind_) {
+        case FILTER_NEAREST:
+            ExpandRow(in, out, scale_);
+            for (int i = 1; i != scale_; ++i) memcpy(out + i * width, out, width * sizeof(uint32_t));
+            break;
+        case FILTER_CRT:
+            // the last output row of each source row is the dark gap
+            ExpandRow(in, out + (scale_ - 1) * width, scale_);
+            MaskRow(out + (scale_ - 1) * width, out, width, false);
+            for (int i = 1; i != scale_ - 1; ++i) memcpy(out + i * width, out, width * sizeof(uint32_t));
+            MaskRow(out + (scale_ - 1) * width, out + (scale_ - 1) * width, width, true);
+            break;
+        case FILTER_SCALE2X:
+        case FILTER_SCALE3X: {
+            PadRow(in_ + (y ? y - 1 : 0) * 256, padded[0]);
+            PadRow(in, padded[1]);
+            PadRow(in_ + (y != 239 ? y + 1 : 239) * 256, padded[2]);
+            if (kind_ == FILTER_SCALE2X) {
+                Scale2xRow(rows, out, out + width);
+            }
+            else {
+                uint32_t* const lines[3] = { out, out + width, out + 2 * width };
+                Scale3xRow(rows, lines);
+            }
+            break;
+        }
+        case FILTER_NTSC:
+            // a line starts 1/3 of a colour cycle after the previous one
+            ntsc_->Line(pixels_ + y * 256, (phase_ + y) % NTSC_PHASES, out);
+            memcpy(out + width, out, width * sizeof(uint32_t));
+            break;
+        default:
+            memcpy(out, in, 256 * sizeof(uint32_t));
+            break;
+        }
+    }
+}
+
+void FrameFilter::Apply(const uint32_t* in, const uint16_t* pixels, uint64_t frame, uint32_t* out){
+    if (kind_ == FILTER_NONE) {
+        memcpy(out, in, 256 * 240 * sizeof(uint32_t));
+        return;
+    }
+    in_ = in;
+    pixels_ = pixels;
+    // odd frames are a dot short
+    phase_ = (int)(frame & 1) * 2;
+    out_ = out;
+    bands_.Run();
+}
@@ -0,0 +1,57 @@
+#ifndef SFCE_FILTER_H_
+#define SFCE_FILTER_H_
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include "bands.h"
+#include "ntsc.h"
+using namespace std;
+
+// output filter
+enum
+{
+    FILTER_NONE = 0,    // 256x240 as rendered
+    FILTER_NEAREST,     // integer nearest neighbour, x scale
+    FILTER_SCALE2X,     // Scale2x (EPX), x2
+    FILTER_SCALE3X,     // Scale3x (AdvMAME3x), x3
+    FILTER_CRT,         // nearest x scale, dimmed scanlines and RGB aperture mask
+    FILTER_NTSC,        // composite video from the PPU pixels, 512x480
+};
+
+// Upscaling stage between the renderer and presentation/capture.
+// Apply() splits the output into bands of source rows, the caller does
+// the first band and a small pool of threads the others, so a frame is
+// done when Apply() returns. Pixels are RGBA in memory order.
+class FrameFilter
+{
+private:
+    int     kind_ = FILTER_NONE;
+    int     scale_ = 1;
+
+    // one band per thread, the caller is band 0
+    BandPool        bands_;
+    const uint32_t* in_ = nullptr;
+    const uint16_t* pixels_ = nullptr;
+    int             phase_ = 0;
+    uint32_t*       out_ = nullptr;
+    int             format_ = PIXEL_RGBA;
+    unique_ptr<NtscFilter> ntsc_;
+
+    static void Band(void* self, int band, int bands);
+    void Band(int band, int bands);
+public:
+    // name: none, nearest, scale2x, scale3x, crt or ntsc; scale for nearest
+    // and crt (2-8), threads including the caller
+    int Init(const string& name, int scale, int threads);
+    // byte order of the PPU pixel filters' output, the others keep the input's
+    void SetPixelFormat(int format);
+    int Kind() const { return kind_; }
+    int Width() const { return kind_ == FILTER_NTSC ? NTSC_WIDTH : 256 * scale_; }
+    int Height() const { return 240 * scale_; }
+    // 256x240 RGBA and PPU pixels (see PpuPixel) in, Width() x Height() out;
+    // `frame` picks the colour phase
+    void Apply(const uint32_t* in, const uint16_t* pixels, uint64_t frame, uint32_t* out);
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "hash.h"
+#include "code.h"
+#include <string.h>
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ull;
+
+static inline uint64_t Rotl(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+static inline uint64_t Load64(const uint8_t* p){
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+static inline uint64_t Round(uint64_t acc, uint64_t input){
+    acc += input * PRIME2;
+    return Rotl(acc, 31) * PRIME1;
+}
+
+uint64_t Hash64(const void* data, size_t size, uint64_t seed){
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* const end = p + size;
+    uint64_t h;
+    if (size >= 32) {
+        uint64_t v0 = seed + PRIME1 + PRIME2;
+        uint64_t v1 = seed + PRIME2;
+        uint64_t v2 = seed;
+        uint64_t v3 = seed - PRIME1;
+        for (; p + 32 <= end; p += 32) {
+            v0 = Round(v0, Load64(p + 0));
+            v1 = Round(v1, Load64(p + 8));
+            v2 = Round(v2, Load64(p + 16));
+            v3 = Round(v3, Load64(p + 24));
+        }
+        h = Rotl(v0, 1) + Rotl(v1, 7) + Rotl(v2, 12) + Rotl(v3, 18);
+        h = (h ^ Round(0, v0)) * PRIME1 + PRIME3;
+        h = (h ^ Round(0, v1)) * PRIME1 + PRIME3;
+        h = (h ^ Round(0, v2)) * PRIME1 + PRIME3;
+        h = (h ^ Round(0, v3)) * PRIME1 + PRIME3;
+    }
+    else h = seed + PRIME3;
+    h += (uint64_t)size;
+    for (; p + 8 <= end; p += 8)
+        h = Rotl(h ^ Round(0, Load64(p)), 27) * PRIME1 + PRIME3;
+    for (; p < end; ++p)
+        h = Rotl(h ^ (*p * PRIME3), 11) * PRIME1;
+    // avalanche
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+HashLog::~HashLog(){
+    Close();
+}
+
+int HashLog::Open(string file){
+    out_ = fopen(file.c_str(), "w");
+    return out_ ? 0 : ERROR_FILE_NOT_EXIST;
+}
+
+int HashLog::OpenGolden(string file){
+    golden_ = fopen(file.c_str(), "r");
+    return golden_ ? 0 : ERROR_FILE_NOT_EXIST;
+}
+
+bool HashLog::Frame(uint64_t frame, uint64_t video, uint64_t state){
+    char line[64];
+    snprintf(line, sizeof(line), "%llu %016llx %016llx\n",
+        (unsigned long long)frame, (unsigned long long)video, (unsigned long long)state);
+    if (out_) fputs(line, out_);
+    ++frames_;
+    if (golden_ && !mismatch_) {
+        char expect[64] = "(end of log)\n";
+        if (!fgets(expect, sizeof(expect), golden_) || strcmp(expect, line) != 0) {
+            mismatch_ = true;
+            printf("hash mismatch at frame %llu\n  expected: %s  actual:   %s",
+                (unsigned long long)frame, expect, line);
+            return false;
+        }
+    }
+    return true;
+}
+
+int HashLog::Close(){
+    char expect[64];
+    if (golden_ && !mismatch_ && fgets(expect, sizeof(expect), golden_)) {
+        mismatch_ = true;
+        printf("hash log ended after %llu frames\n  expected: %s  actual:   (end of run)\n",
+            (unsigned long long)frames_, expect);
+    }
+    if (out_) fclose(out_);
+    if (golden_) fclose(golden_);
+    out_ = nullptr;
+    golden_ = nullptr;
+    frames_ = 0;
+    return mismatch_ ? ERROR_FILED : 0;
+}
@@ -0,0 +1,34 @@
+#ifndef SFCE_HASH_H_
+#define SFCE_HASH_H_
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+using namespace std;
+
+// Fast non-cryptographic 64-bit hash. Four independent lanes over
+// 32-byte stripes, so the inner loop vectorizes/pipelines well.
+uint64_t Hash64(const void* data, size_t size, uint64_t seed = 0);
+
+// one line per frame: "<frame> <video hash> <state hash>"
+class HashLog
+{
+private:
+    FILE*    out_ = nullptr;
+    FILE*    golden_ = nullptr;
+    bool     mismatch_ = false;
+    uint64_t frames_ = 0;
+public:
+    ~HashLog();
+    int Open(string file);
+    // compare against a previously written log
+    int OpenGolden(string file);
+    bool IsOpen() const { return out_ || golden_; }
+    // returns false at the first line that differs from the golden log
+    bool Frame(uint64_t frame, uint64_t video, uint64_t state);
+    bool Mismatch() const { return mismatch_; }
+    // also a mismatch when the golden log has lines the run did not reach
+    int Close();
+};
+
+#endif
@@ -1,29 +1,431 @@
 #include "famicom.h"
 #include <iostream>
 #include <string>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <chrono>
+#include <thread>
 #include "2d.h"
+#include "pool.h"
+#include "env.h"
+#include "disasm.h"
 Famicom famicom;
 
-int main() {
-    
-    famicom.Init("/Users/lolly/prog/SFCE/smb.nes");
+// xorshift32 step, the low byte as controller bits
+static uint8_t RandomInput(uint32_t& seed){
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return (uint8_t)seed;
+}
+
+// `count` machines sharing the ROM of `source`, logic only
+static int RunInstances(const Famicom& source, int count, int frames){
+    FamicomPool pool((size_t)count);
+    vector<Famicom*> machines;
+    for (int i = 0; i != count; ++i) {
+        Famicom* fc = pool.Create();
+        const int code = fc ? fc->Init(source) : ERROR_OUT_OF_MEMORY;
+        if (code != 0) {
+            printf("failed to start instance %d (%d)\n", i, code);
+            pool.Destroy(fc);
+            for (size_t j = 0; j != machines.size(); ++j) pool.Destroy(machines[j]);
+            return code;
+        }
+        machines.push_back(fc);
+    }
+    const auto start = chrono::steady_clock::now();
+    for (int f = 0; f != frames; ++f)
+        for (size_t i = 0; i != machines.size(); ++i) machines[i]->RunFrame();
+    const auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    printf("%d instances x %d frames in %lld ms, %zu bytes each (+%zu SRAM)\n",
+        count, frames, (long long)ms, pool.Stride(), machines[0]->PrivateHeapSize());
+    for (size_t i = 0; i != machines.size(); ++i) pool.Destroy(machines[i]);
+    return 0;
+}
+
+// `count` rollouts of `frames` frames of random input, each forked from
+// `root`; the last one is replayed on `root` itself as a check
+static int RunRollouts(Famicom& root, int count, int frames, uint32_t seed){
+    Famicom* child = new Famicom();
+    vector<uint8_t> inputs((size_t)frames);
+    uint64_t copied = 0;
+    uint64_t hash = 0;
+    const auto start = chrono::steady_clock::now();
+    for (int r = 0; r != count; ++r) {
+        root.Fork(*child);
+        for (int f = 0; f != frames; ++f) {
+            inputs[f] = RandomInput(seed);
+            child->SetControllerBits(0, inputs[f]);
+            child->RunFrame();
+        }
+        copied += child->CopiedPages();
+        hash = child->StateHash();
+    }
+    const auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    // releases root
+    delete child;
+    for (int f = 0; f != frames; ++f) {
+        root.SetControllerBits(0, inputs[f]);
+        root.RunFrame();
+    }
+    const bool same = root.StateHash() == hash;
+    printf("%d rollouts x %d frames in %lld ms, %.1f pages copied per rollout, replay %s\n",
+        count, frames, (long long)ms, count ? (double)copied / count : 0.0, same ? "matches" : "differs");
+    return same ? 0 : ERROR_FILED;
+}
+
+// a full save-state, then a delta every `every` frames over `frames` frames
+// of random input; a second machine replays base + deltas to verify
+static int RunCheckpoints(Famicom& root, int every, int frames, uint32_t seed){
+    vector<uint8_t> base;
+    root.SaveState(base);
+    root.TrackDirty(true);
+    vector<vector<uint8_t> > deltas;
+    size_t bytes = 0;
+    long long us = 0;
+    uint64_t hash = root.StateHash();
+    for (int f = 1; f <= frames; ++f) {
+        root.SetControllerBits(0, RandomInput(seed));
+        root.RunFrame();
+        if (f % every) continue;
+        const auto start = chrono::steady_clock::now();
+        deltas.push_back(vector<uint8_t>());
+        root.SaveDelta(deltas.back());
+        us += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+        bytes += deltas.back().size();
+        hash = root.StateHash();
+    }
+    root.TrackDirty(false);
+
+    Famicom* replica = new Famicom();
+    int code = replica->Init(root);
+    if (code == 0) code = replica->LoadState(base.data(), base.size());
+    for (size_t i = 0; i != deltas.size() && code == 0; ++i)
+        code = replica->LoadDelta(deltas[i].data(), deltas[i].size());
+    const bool same = code == 0 && replica->StateHash() == hash;
+    delete replica;
+    const size_t count = deltas.size();
+    printf("%zu checkpoints, full state %zu bytes, delta %.1f bytes / %.1f us on average, restore %s\n",
+        count, base.size(), count ? (double)bytes / count : 0.0, count ? (double)us / count : 0.0,
+        same ? "matches" : "differs");
+    return same ? 0 : ERROR_FILED;
+}
+
+// `count` environments stepped `steps` times with random actions on
+// `threads` threads; instance 0's actions are replayed on `root` as a check
+static int RunEnv(Famicom& root, int count, int steps, int threads, const EnvSpec& spec, uint32_t seed){
+    VectorEnv env;
+    const int code = env.Init(root, count, spec, threads);
+    if (code != 0) {
+        printf("failed to start %d environments (%d)\n", count, code);
+        return code;
+    }
+    vector<uint8_t> actions((size_t)count);
+    vector<uint8_t> observations(env.ObservationSize() * count);
+    vector<int32_t> rewards((size_t)count);
+    vector<uint8_t> history((size_t)steps);
+    env.Reset(observations.data());
+    const auto start = chrono::steady_clock::now();
+    for (int s = 0; s != steps; ++s) {
+        for (int i = 0; i != count; ++i) {
+            actions[i] = RandomInput(seed);
+        }
+        history[s] = actions[0];
+        env.Step(actions.data(), observations.data(), rewards.data(), nullptr);
+    }
+    const auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    const uint64_t hash = env.Instance(0).StateHash();
+    for (int s = 0; s != steps; ++s) {
+        root.SetControllerBits(0, history[s]);
+        for (int f = 0; f != frame_skip; ++f) root.RunFrame();
+    }
+    const bool same = root.StateHash() == hash;
+    printf("%d environments x %d steps of %d frames, %zu-byte observations, on %d threads in %lld ms, %.0f steps/s, replay %s\n",
+        count, steps, frame_skip, env.ObservationSize(), threads, (long long)ms,
+        ms ? (double)count * steps * 1000 / ms : 0.0, same ? "matches" : "differs");
+    return same ? 0 : ERROR_FILED;
+}
+
+// listing of the PRG mapped at $8000-$FFFF after power-on into `file`
+static int RunDisasm(Famicom& fc, const string& file){
+    uint8_t prg[0x8000];
+    for (uint32_t a = 0; a != sizeof(prg); ++a) prg[a] = fc.cpu_.Peek((uint16_t)(0x8000 + a));
+    vector<DisasmLine> lines(sizeof(prg));
+    const auto start = chrono::steady_clock::now();
+    const size_t count = DisassembleBank(prg, sizeof(prg), 0x8000, lines.data(), lines.size());
+    vector<char> text(FormatListing(lines.data(), count, nullptr, 0) + 1);
+    FormatListing(lines.data(), count, text.data(), text.size());
+    const auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    FILE* out = file == "-" ? stdout : fopen(file.c_str(), "w");
+    if (!out) {
+        printf("failed to open %s\n", file.c_str());
+        return ERROR_FILED;
+    }
+    fwrite(text.data(), 1, text.size() - 1, out);
+    if (out != stdout) fclose(out);
+    printf("%zu instructions, %zu bytes of listing in %lld us\n",
+        count, text.size() - 1, (long long)us);
+    return 0;
+}
+
+static void Usage(const char* name){
+    printf(
+        "usage: %s [options] rom.nes\n"
+        "  --trace             print every executed instruction\n"
+        "  --debug             stop at the first instruction in the debugger\n"
+        "                      (F12 in the window breaks in at any time)\n"
+        "  --break ADDR        debugger breakpoint at hex ADDR, may be repeated\n"
+        "  --cdl FILE          log PRG code/data and CHR usage to a .cdl file,\n"
+        "                      merging with FILE if it exists\n"
+        "  --cheat CODE        apply a Game Genie or raw AAAA[?CC]:VV code,\n"
+        "                      may be repeated\n"
+        "  --disasm FILE       write a listing of the PRG at $8000-$FFFF to FILE\n"
+        "                      (- for stdout) and exit\n"
+        "  --diff              check every instruction against the reference\n"
+        "                      core, stop at the first mismatch\n"
+        "  --diff-random N     run N random instructions in a sandbox through\n"
+        "                      both cores and exit\n"
+        "  --seed S            seed for --diff-random (default 1)\n"
+        "  --instances N       run N machines sharing the ROM for --frames\n"
+        "                      frames (default 60) and exit\n"
+        "  --rollouts N        fork N copy-on-write rollouts of --frames frames\n"
+        "                      (default 60) of random input, after --resume\n"
+        "                      or --fast-forward, and exit\n"
+        "  --checkpoints K     take an incremental snapshot every K frames over\n"
+        "                      --frames frames (default 600) of random input,\n"
+        "                      verify the restore, and exit\n"
+        "  --env N             step N environments --frames times (default 1000)\n"
+        "                      with random actions held for --frameskip frames,\n"
+        "                      after --resume or --fast-forward, and exit\n"
+        "  --env-threads N     threads the environments are stepped on\n"
+        "                      (default: cores)\n"
+        "  --env-obs WxH       --env observations of WxH luminance, e.g. 84x84\n"
+        "                      (default: 256x240 colour indices)\n"
+        "  --env-max-pool      --env luminance observations are the maximum of\n"
+        "                      the last two frames of a step\n"
+        "  --fast-forward N    run N frames without rendering before showing\n"
+        "  --turbo             start in turbo mode (Tab toggles)\n"
+        "  --frameskip K       render every Kth frame in turbo mode (default 4)\n"
+        "  --frames N          run N frames headless, render only the last one\n"
+        "  --pipeline          headless: render frames on a worker thread while\n"
+        "                      the next frame runs\n"
+        "  --record FILE       record controller input to a movie\n"
+        "  --play FILE         play a movie back (headless: whole movie by default)\n"
+        "  --resume FILE       start from a save-state instead of power-on\n"
+        "  --save-state FILE   write a save-state when the run ends\n"
+        "  --dump FILE         write rendered frames to FILE (.y4m: Y4M, else PPM,\n"
+        "                      \"|command\" pipes them to a command)\n"
+        "  --filter NAME       window and --dump output filter: none, nearest,\n"
+        "                      scale2x, scale3x, crt or ntsc (default none)\n"
+        "  --scale N           nearest and crt scale, 2-8 (default 3)\n"
+        "  --filter-threads N  threads a frame is filtered on (default: cores, up to 4)\n"
+        "  --hash FILE         write per-frame video and machine state hashes\n"
+        "  --hash-check FILE   compare per-frame hashes against FILE, stop at\n"
+        "                      the first mismatch\n",
+        name
+    );
+}
+
+int main(int argc, char* argv[]) {
+    string romfile;
+    bool trace = false;
+    int headless_frames = 0;
+    string record_file;
+    string play_file;
+    string dump_file;
+    string hash_file;
+    string golden_file;
+    string resume_file;
+    string state_file;
+    vector<string> cheat_codes;
+    bool debug = false;
+    string cdl_file;
+    string disasm_file;
+    vector<uint16_t> breakpoints;
+    bool diff_run = false;
+    uint64_t diff_random = 0;
+    uint32_t seed = 1;
+    int instances = 0;
+    int rollouts = 0;
+    int checkpoints = 0;
+    int envs = 0;
+    int env_threads = (int)thread::hardware_concurrency();
+    EnvSpec env_spec;
+    string filter_name = "none";
+    int filter_scale = 3;
+    int filter_threads = (int)thread::hardware_concurrency();
+    if (filter_threads > 4) filter_threads = 4;
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--trace")) trace = true;
+        else if (!strcmp(argv[i], "--turbo")) turbo = true;
+        else if (!strcmp(argv[i], "--pipeline")) pipelined = true;
+        else if (!strcmp(argv[i], "--filter") && has_value) filter_name = argv[++i];
+        else if (!strcmp(argv[i], "--scale") && has_value) filter_scale = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--filter-threads") && has_value) filter_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--debug")) debug = true;
+        else if (!strcmp(argv[i], "--cdl") && has_value) cdl_file = argv[++i];
+        else if (!strcmp(argv[i], "--break") && has_value) breakpoints.push_back((uint16_t)strtoul(argv[++i], nullptr, 16));
+        else if (!strcmp(argv[i], "--disasm") && has_value) disasm_file = argv[++i];
+        else if (!strcmp(argv[i], "--diff")) diff_run = true;
+        else if (!strcmp(argv[i], "--diff-random") && has_value) diff_random = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--instances") && has_value) instances = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--rollouts") && has_value) rollouts = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--checkpoints") && has_value) checkpoints = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--env") && has_value) envs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--env-threads") && has_value) env_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--env-obs") && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &env_spec.obs_width, &env_spec.obs_height) != 2) {
+                Usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--env-max-pool")) env_spec.max_pool = true;
+        else if (!strcmp(argv[i], "--seed") && has_value) seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--cheat") && has_value) cheat_codes.push_back(argv[++i]);
+        else if (!strcmp(argv[i], "--fast-forward") && has_value) fast_forward_frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--frameskip") && has_value) frame_skip = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && has_value) headless_frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--record") && has_value) record_file = argv[++i];
+        else if (!strcmp(argv[i], "--play") && has_value) play_file = argv[++i];
+        else if (!strcmp(argv[i], "--resume") && has_value) resume_file = argv[++i];
+        else if (!strcmp(argv[i], "--save-state") && has_value) state_file = argv[++i];
+        else if (!strcmp(argv[i], "--dump") && has_value) dump_file = argv[++i];
+        else if (!strcmp(argv[i], "--hash") && has_value) hash_file = argv[++i];
+        else if (!strcmp(argv[i], "--hash-check") && has_value) golden_file = argv[++i];
+        else if (argv[i][0] != '-') romfile = argv[i];
+        else {
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    if (romfile.empty() || frame_skip < 1) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    const int code = famicom.Init(romfile);
+    if (code != 0) {
+        printf("failed to load %s (%d)\n", romfile.c_str(), code);
+        return code;
+    }
     famicom.ShowInfo();
+    famicom.cpu_.trace_ = trace;
+    if (!disasm_file.empty()) return RunDisasm(famicom, disasm_file);
+    if (diff_random) return diff.RunRandom(famicom, seed, diff_random);
+    if (instances > 0) return RunInstances(famicom, instances, headless_frames ? headless_frames : 60);
+    if (diff_run) diff.Attach(famicom);
+    if (!resume_file.empty()) {
+        const auto start = chrono::steady_clock::now();
+        const int resume_code = famicom.ResumeStateFile(resume_file);
+        if (resume_code != 0) {
+            printf("failed to resume from %s (%d)\n", resume_file.c_str(), resume_code);
+            return resume_code;
+        }
+        const auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+        printf("resumed at frame %llu in %lld us\n",
+            (unsigned long long)famicom.FrameCount(), (long long)us);
+    }
+    if (rollouts > 0) {
+        RunFrames(fast_forward_frames);
+        return RunRollouts(famicom, rollouts, headless_frames ? headless_frames : 60, seed);
+    }
+    if (checkpoints > 0) {
+        RunFrames(fast_forward_frames);
+        return RunCheckpoints(famicom, checkpoints, headless_frames ? headless_frames : 600, seed);
+    }
+    if (envs > 0) {
+        RunFrames(fast_forward_frames);
+        env_spec.frameskip = frame_skip;
+        return RunEnv(famicom, envs, headless_frames ? headless_frames : 1000, env_threads, env_spec, seed);
+    }
+    if (debug || !breakpoints.empty()) {
+        famicom.cpu_.debugger_ = &debugger;
+        for (size_t i = 0; i != breakpoints.size(); ++i)
+            debugger.SetBreakpoint(breakpoints[i], true);
+        if (debug) debugger.Interrupt();
+    }
+    CodeDataLog cdl;
+    if (!cdl_file.empty()) {
+        famicom.AttachCdl(&cdl);
+        const int cdl_code = cdl.Load(cdl_file);
+        if (cdl_code != 0 && cdl_code != ERROR_FILE_NOT_EXIST) {
+            printf("%s is not a log of this ROM\n", cdl_file.c_str());
+            return cdl_code;
+        }
+    }
+    for (size_t i = 0; i != cheat_codes.size(); ++i) {
+        if (famicom.AddCheat(cheat_codes[i]) != 0) {
+            printf("bad cheat code %s\n", cheat_codes[i].c_str());
+            return ERROR_ILLEGAL_CODE;
+        }
+    }
+
+    int movie_code = 0;
+    if (!play_file.empty()) {
+        movie_code = movie.Play(play_file, famicom);
+        if (movie_code == 0 && headless_frames == 0) headless_frames = (int)movie.FrameCount();
+    }
+    else if (!record_file.empty()) movie_code = movie.Record(record_file, famicom);
+    if (movie_code != 0) {
+        printf("movie error (%d)\n", movie_code);
+        return movie_code;
+    }
 
     // show cpu vectors
     // V0 - NMI
-    uint16_t v0 = famicom.cpu_->Read(CPU_NMI + 0);
-    v0 |= famicom.cpu_->Read(CPU_NMI + 1) << 8;
+    uint16_t v0 = famicom.cpu_.Read(CPU_NMI + 0);
+    v0 |= famicom.cpu_.Read(CPU_NMI + 1) << 8;
     // V1 - RESET
-    uint16_t v1 = famicom.cpu_->Read(CPU_RESET + 0);
-    v1 |= famicom.cpu_->Read(CPU_RESET + 1) << 8;
+    uint16_t v1 = famicom.cpu_.Read(CPU_RESET + 0);
+    v1 |= famicom.cpu_.Read(CPU_RESET + 1) << 8;
     // V2 - IRQ/BRK
-    uint16_t v2 = famicom.cpu_->Read(CPU_IRQBRK + 0);
-    v2 |= famicom.cpu_->Read(CPU_IRQBRK + 1) << 8;
+    uint16_t v2 = famicom.cpu_.Read(CPU_IRQBRK + 0);
+    v2 |= famicom.cpu_.Read(CPU_IRQBRK + 1) << 8;
 
     printf(
         "ROM: NMI: $%04X  RESET: $%04X  IRQ/BRK: $%04X\n",
         (int)v0, (int)v1, (int)v2
     );
-    CreateWindow();
-    return 0;
-}
\ No newline at end of file
+    if (filter.Init(filter_name, filter_scale, filter_threads) != 0) {
+        printf("unknown filter %s x%d\n", filter_name.c_str(), filter_scale);
+        return ERROR_UNSUPPORTED;
+    }
+    if (!dump_file.empty() && video.Open(dump_file, filter.Width(), filter.Height()) != 0) {
+        printf("failed to open %s\n", dump_file.c_str());
+        return ERROR_FILED;
+    }
+    if ((!hash_file.empty() && hashes.Open(hash_file) != 0)
+        || (!golden_file.empty() && hashes.OpenGolden(golden_file) != 0)) {
+        printf("failed to open hash log\n");
+        return ERROR_FILED;
+    }
+    if (headless_frames > 0) {
+        RunFrames(fast_forward_frames);
+        RunHeadless(headless_frames);
+    }
+    else CreateWindow();
+    if (video.IsOpen()) {
+        const uint64_t frames = video.Frames();
+        const uint64_t stalls = video.Stalls();
+        video.Close();
+        printf("video: %llu frames, %llu stalls\n",
+            (unsigned long long)frames, (unsigned long long)stalls);
+    }
+    if (!cdl_file.empty()) {
+        cdl.Print(stdout);
+        if (cdl.Save(cdl_file) != 0) printf("failed to write %s\n", cdl_file.c_str());
+    }
+    if (!state_file.empty() && famicom.SaveStateFile(state_file) != 0)
+        printf("failed to write %s\n", state_file.c_str());
+    if (diff_run) {
+        printf("diff: %llu instructions checked%s\n",
+            (unsigned long long)diff.Instructions(), diff.Failed() ? ", mismatch" : "");
+    }
+    const int hash_code = hashes.Close();
+    const int movie_code_end = movie.Close();
+    if (diff.Failed()) return ERROR_FILED;
+    return hash_code ? hash_code : movie_code_end;
+}
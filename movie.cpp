@@ -0,0 +1,96 @@
+#include "movie.h"
+#include "famicom.h"
+#include <fstream>
+using namespace std;
+
+static const uint16_t MOVIE_VERSION = 1;
+static const uint8_t  MOVIE_CONTROLLERS = 2;
+
+static uint32_t MovieId(){
+    union {uint32_t u32; uint8_t id[4];} id;
+    id.id[0] = 'S';
+    id.id[1] = 'F';
+    id.id[2] = 'C';
+    id.id[3] = 'M';
+    return id.u32;
+}
+
+int Movie::Record(string file, const Famicom& famicom){
+    file_ = file;
+    header_.id = MovieId();
+    header_.version = MOVIE_VERSION;
+    header_.controllers = MOVIE_CONTROLLERS;
+    header_.start = MOVIE_POWER_ON;
+    header_.rom_hash = famicom.RomHash();
+    header_.frame_count = 0;
+    header_.state_size = 0;
+    state_.clear();
+    if (famicom.FrameCount() != 0) {
+        famicom.SaveState(state_);
+        header_.start = MOVIE_SAVESTATE;
+        header_.state_size = (uint32_t)state_.size();
+    }
+    input_.clear();
+    frame_ = 0;
+    mode_ = MOVIE_RECORD;
+    return 0;
+}
+
+int Movie::Play(string file, Famicom& famicom){
+    ifstream movie_if(file, ios::binary | ios::in);
+    if(!movie_if) return ERROR_FILE_NOT_EXIST;
+
+    movie_if.read((char*)&header_, sizeof(header_));
+    if(!movie_if || header_.id != MovieId() || header_.version != MOVIE_VERSION
+        || header_.controllers != MOVIE_CONTROLLERS)
+        return ERROR_ILLEGAL_FILE;
+    if(header_.rom_hash != famicom.RomHash()) return ERROR_ROM_MISMATCH;
+    if(header_.start != MOVIE_POWER_ON && header_.start != MOVIE_SAVESTATE) return ERROR_UNSUPPORTED;
+
+    state_.resize(header_.state_size);
+    movie_if.read((char*)state_.data(), state_.size());
+    if(!movie_if) return ERROR_ILLEGAL_FILE;
+    if(header_.start == MOVIE_SAVESTATE) {
+        const int code = famicom.LoadState(state_.data(), state_.size());
+        if(code != 0) return code;
+    }
+
+    input_.resize((size_t)header_.frame_count * header_.controllers);
+    movie_if.read((char*)input_.data(), input_.size());
+    if(!movie_if) return ERROR_ILLEGAL_FILE;
+
+    file_ = file;
+    frame_ = 0;
+    mode_ = MOVIE_PLAY;
+    return 0;
+}
+
+void Movie::Frame(Famicom& famicom){
+    switch (mode_) {
+    case MOVIE_RECORD:
+        for (int i = 0; i != MOVIE_CONTROLLERS; ++i)
+            input_.push_back(famicom.ControllerBits(i));
+        ++frame_;
+        break;
+    case MOVIE_PLAY:
+        if (frame_ >= header_.frame_count) break;
+        for (int i = 0; i != MOVIE_CONTROLLERS; ++i)
+            famicom.SetControllerBits(i, input_[(size_t)frame_ * MOVIE_CONTROLLERS + i]);
+        ++frame_;
+        break;
+    }
+}
+
+int Movie::Close(){
+    const int mode = mode_;
+    mode_ = MOVIE_NONE;
+    if (mode != MOVIE_RECORD) return 0;
+
+    ofstream movie_of(file_, ios::binary | ios::out | ios::trunc);
+    if(!movie_of) return ERROR_FILED;
+    header_.frame_count = frame_;
+    movie_of.write((const char*)&header_, sizeof(header_));
+    movie_of.write((const char*)state_.data(), state_.size());
+    movie_of.write((const char*)input_.data(), input_.size());
+    return movie_of ? 0 : ERROR_FILED;
+}
@@ -0,0 +1,62 @@
+#ifndef SFCE_MOVIE_H_
+#define SFCE_MOVIE_H_
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std;
+
+class Famicom;
+
+// movie start point
+enum
+{
+    MOVIE_POWER_ON  = 0,    // 从上电开始
+    MOVIE_SAVESTATE = 1,    // 从存档开始, 存档紧跟文件头
+};
+
+enum
+{
+    MOVIE_NONE = 0,
+    MOVIE_RECORD,
+    MOVIE_PLAY,
+};
+
+// file header, followed by `state_size` bytes of save-state and then
+// `controllers` bytes per frame (bit i = button i of that controller)
+struct MovieHeader
+{
+    uint32_t    id;             // "SFCM"
+    uint16_t    version;
+    uint8_t     controllers;
+    uint8_t     start;
+    uint64_t    rom_hash;
+    uint32_t    frame_count;
+    uint32_t    state_size;
+};
+
+class Movie
+{
+private:
+    string          file_;
+    MovieHeader     header_;
+    vector<uint8_t> input_;
+    // save-state the movie starts from (MOVIE_SAVESTATE)
+    vector<uint8_t> state_;
+    uint32_t        frame_ = 0;
+    int             mode_ = MOVIE_NONE;
+public:
+    // a machine that has already run frames is recorded from a save-state
+    int Record(string file, const Famicom&);
+    // loads the save-state of MOVIE_SAVESTATE movies into the machine
+    int Play(string file, Famicom&);
+    // called at every frame boundary, before the frame runs:
+    // records the controllers, or overrides them during playback
+    void Frame(Famicom&);
+    // writes a recording out, stops playback
+    int Close();
+    int Mode() const { return mode_; }
+    bool Finished() const { return mode_ == MOVIE_PLAY && frame_ >= header_.frame_count; }
+    uint32_t FrameCount() const { return header_.frame_count; }
+};
+
+#endif
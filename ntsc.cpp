@@ -0,0 +1,119 @@
+#include "ntsc.h"
+#include <math.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// PPU output levels (V), per luma level, for the low and high half of the
+// square wave, see the nesdev wiki "NTSC video"
+static const float LEVEL_LOW[4] = { 0.350f, 0.518f, 0.962f, 1.550f };
+static const float LEVEL_HIGH[4] = { 1.094f, 1.506f, 1.962f, 1.962f };
+static const float BLACK = 0.518f;
+static const float WHITE = 1.962f;
+// colour emphasis attenuates a third of the wave
+static const float ATTENUATION = 0.746f;
+// decoder hue, in 1/12 of a colour cycle, fitted to the RGB palette
+static const float HUE = 3.8f;
+
+// signal at one of the 12 samples of a colour cycle, 0 = black, 1 = white
+static float Signal(uint16_t pixel, int phase){
+    const int color = pixel & 0x0f;
+    const int emphasis = pixel >> 6;
+    // $xE/$xF are black
+    const int level = color > 13 ? 1 : (pixel >> 4) & 3;
+    float low = LEVEL_LOW[level];
+    float high = LEVEL_HIGH[level];
+    if (color == 0) low = high;
+    if (color > 12) high = low;
+    // hue n is high for the 6 samples starting at 12 - n
+    const bool in_phase = (color + phase) % 12 < 6;
+    float signal = in_phase ? high : low;
+    const bool attenuated = ((emphasis & 1) && (0 + phase) % 12 < 6)
+        || ((emphasis & 2) && (4 + phase) % 12 < 6)
+        || ((emphasis & 4) && (8 + phase) % 12 < 6);
+    if (attenuated && color < 14) signal *= ATTENUATION;
+    return (signal - BLACK) / (WHITE - BLACK);
+}
+
+NtscFilter::NtscFilter(int format) : format_(format){
+    const float pi = 3.14159265f;
+    kernels_.assign(512 * NTSC_PHASES * NTSC_TAPS * 4, 0);
+    for (int pixel = 0; pixel != 512; ++pixel) {
+        for (int phase = 0; phase != NTSC_PHASES; ++phase) {
+            int16_t* kernel = &kernels_[(pixel * NTSC_PHASES + phase) * NTSC_TAPS * 4];
+            for (int tap = 0; tap != NTSC_TAPS; ++tap) {
+                // centre of the output pixel in samples, 8 per PPU pixel
+                const int center = (tap - NTSC_RADIUS) * 4 + 2;
+                float y = 0, i = 0, q = 0;
+                for (int s = 0; s != 8; ++s) {
+                    const int sample_phase = (phase * 4 + s) % 12;
+                    const float v = Signal((uint16_t)pixel, sample_phase);
+                    const int d = s - center;
+                    // luma: one colour cycle, the carrier cancels out
+                    if (d >= -6 && d < 6) y += v / 12;
+                    // chroma: two cycles, triangular
+                    if (d >= -12 && d < 12) {
+                        const float w = (12 - fabsf(d + 0.5f)) / 144;
+                        const float angle = 2 * pi * (sample_phase + HUE) / 12;
+                        i += 2 * w * v * cosf(angle);
+                        q += 2 * w * v * sinf(angle);
+                    }
+                }
+                // YIQ to RGB
+                const float rgb[3] = {
+                    y + 0.946882f * i + 0.623557f * q,
+                    y - 0.274788f * i - 0.635691f * q,
+                    y - 1.108545f * i + 1.709007f * q,
+                };
+                for (int c = 0; c != 3; ++c) {
+                    const int channel = format == PIXEL_BGRA ? 2 - c : c;
+                    kernel[tap * 4 + channel] = (int16_t)lrintf(rgb[c] * 255 * 32);
+                }
+            }
+        }
+    }
+}
+
+void NtscFilter::Line(const uint16_t* pixels, int phase, uint32_t* out) const{
+    // output pixel o sums at o + NTSC_RADIUS
+    int16_t acc[(NTSC_WIDTH + NTSC_TAPS) * 4];
+    memset(acc, 0, sizeof(acc));
+    const int16_t* const kernels = kernels_.data();
+    for (int k = 0; k != 256; ++k) {
+        const int16_t* kernel = kernels + ((pixels[k] & 0x1ff) * NTSC_PHASES + phase) * NTSC_TAPS * 4;
+        int16_t* sum = acc + k * 2 * 4;
+#ifdef __SSE2__
+        for (int v = 0; v != NTSC_TAPS * 4; v += 8) {
+            const __m128i a = _mm_loadu_si128((const __m128i*)(sum + v));
+            _mm_storeu_si128((__m128i*)(sum + v),
+                _mm_adds_epi16(a, _mm_loadu_si128((const __m128i*)(kernel + v))));
+        }
+#else
+        for (int v = 0; v != NTSC_TAPS * 4; ++v) sum[v] = (int16_t)(sum[v] + kernel[v]);
+#endif
+        // 8 samples per pixel, 12 per colour cycle
+        phase = phase == 0 ? 2 : phase - 1;
+    }
+
+    const int16_t* sum = acc + NTSC_RADIUS * 4;
+    int o = 0;
+#ifdef __SSE2__
+    const __m128i round = _mm_set1_epi16(16);
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+    for (; o != NTSC_WIDTH; o += 4) {
+        const __m128i a = _mm_srai_epi16(_mm_adds_epi16(_mm_loadu_si128((const __m128i*)(sum + o * 4)), round), 5);
+        const __m128i b = _mm_srai_epi16(_mm_adds_epi16(_mm_loadu_si128((const __m128i*)(sum + o * 4 + 8)), round), 5);
+        _mm_storeu_si128((__m128i*)(out + o), _mm_or_si128(_mm_packus_epi16(a, b), alpha));
+    }
+#endif
+    for (; o != NTSC_WIDTH; ++o) {
+        uint32_t px = 0xff000000;
+        for (int c = 0; c != 3; ++c) {
+            int v = (sum[o * 4 + c] + 16) >> 5;
+            v = v < 0 ? 0 : v > 255 ? 255 : v;
+            px |= (uint32_t)v << (c * 8);
+        }
+        out[o] = px;
+    }
+}
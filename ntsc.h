@@ -0,0 +1,34 @@
+#ifndef SFCE_NTSC_H_
+#define SFCE_NTSC_H_
+#include <cstdint>
+#include <vector>
+#include "palette.h"
+using namespace std;
+
+enum
+{
+    NTSC_WIDTH      = 512,  // 2 output pixels per PPU pixel
+    NTSC_PHASES     = 3,    // a PPU pixel starts at 0, 1/3 or 2/3 of a colour cycle
+    NTSC_TAPS       = 8,    // output pixels a PPU pixel reaches
+    NTSC_RADIUS     = 3,    // of them, left of its own pair
+};
+
+// Composite video filter.
+// The decoder is linear, so the RGB a PPU pixel adds to its neighbours
+// only depends on its 9-bit value and its colour phase: those kernels are
+// synthesized from the PPU's square wave and decoded once, a line is then
+// the sum of one kernel per pixel.
+class NtscFilter
+{
+private:
+    // [pixel][phase][tap][4 channels in format_ order], 5 fraction bits
+    vector<int16_t> kernels_;
+    int format_;
+public:
+    explicit NtscFilter(int format = PIXEL_RGBA);
+    int Format() const { return format_; }
+    // 256 PPU pixels in, NTSC_WIDTH pixels out; `phase` (0-2) of the first pixel
+    void Line(const uint16_t* pixels, int phase, uint32_t* out) const;
+};
+
+#endif
@@ -0,0 +1,232 @@
+#include "obs.h"
+#include "famicom.h"
+#include "bgcache.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// weight of each of `count` source units over `outputs` output units:
+// output o covers [o * count, (o + 1) * count) in 1/outputs units, a
+// source unit s [s * outputs, (s + 1) * outputs); cumulative rounding so
+// every output's weights sum to exactly `total`
+static int Weight(int source, int output, int count, int outputs, int total){
+    const int begin = output * count;
+    const int span = count;
+    int before = source * outputs - begin;
+    int after = (source + 1) * outputs - begin;
+    before = before < 0 ? 0 : before > span ? span : before;
+    after = after < 0 ? 0 : after > span ? span : after;
+    return (after * total + span / 2) / span - (before * total + span / 2) / span;
+}
+
+int ObservationRenderer::Init(int width, int height){
+    if (width < 64 || width > 256 || height < 60 || height > 240) return ERROR_UNSUPPORTED;
+    width_ = width;
+    height_ = height;
+    // a line overlaps at most two rows while rows are at least a line high
+    for (int line = 0; line != 240; ++line) {
+        const int row = line * height / 240;
+        rows_[line] = (uint8_t)row;
+        row_weights_[line][0] = (uint8_t)Weight(line, row, 240, height, OBS_ROW_WEIGHT);
+        row_weights_[line][1] = (uint8_t)(row + 1 < height
+            ? Weight(line, row + 1, 240, height, OBS_ROW_WEIGHT) : 0);
+    }
+    // at most 5 columns per pixel at 64 wide
+    starts_.assign((size_t)width, 0);
+    weights_.assign((size_t)width * OBS_TAPS, 0);
+    for (int x = 0; x != width; ++x) {
+        int start = x * 256 / width;
+        if (start > 256 - OBS_TAPS) start = 256 - OBS_TAPS;
+        starts_[x] = (uint16_t)start;
+        for (int tap = 0; tap != OBS_TAPS; ++tap)
+            weights_[x * OBS_TAPS + tap] = (int16_t)Weight(start + tap, x, 256, width, OBS_COL_WEIGHT);
+    }
+    return 0;
+}
+
+// a pattern byte as 8 byte masks, leftmost pixel in the low byte
+namespace {
+struct PlaneMasks
+{
+    uint64_t masks[256];
+    PlaneMasks(){
+        for (int b = 0; b != 256; ++b) {
+            masks[b] = 0;
+            for (int x = 0; x != 8; ++x)
+                if (b >> (7 - x) & 1) masks[b] |= (uint64_t)0xff << (x * 8);
+        }
+    }
+};
+}
+static const PlaneMasks planes;
+static const uint64_t BYTES = 0x0101010101010101ull;
+
+// sums: one output row of 256 columns, OBS_ROW_WEIGHT x luma
+void ObservationRenderer::FinishRow(const uint16_t* sums, uint8_t* out) const{
+    const int shift = 14;   // log2(OBS_ROW_WEIGHT * OBS_COL_WEIGHT)
+    int x = 0;
+#ifdef __SSE2__
+    // sums stay below 2^15 (64 x 255), so they multiply as signed; four
+    // pixels at a time, their partial sums transposed and added
+    const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+    for (; x + 4 <= width_; x += 4) {
+        __m128i v[4];
+        for (int i = 0; i != 4; ++i)
+            v[i] = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(sums + starts_[x + i])),
+                _mm_loadu_si128((const __m128i*)&weights_[(x + i) * OBS_TAPS]));
+        const __m128i s01 = _mm_add_epi32(_mm_unpacklo_epi32(v[0], v[1]), _mm_unpackhi_epi32(v[0], v[1]));
+        const __m128i s23 = _mm_add_epi32(_mm_unpacklo_epi32(v[2], v[3]), _mm_unpackhi_epi32(v[2], v[3]));
+        __m128i s = _mm_add_epi32(_mm_unpacklo_epi64(s01, s23), _mm_unpackhi_epi64(s01, s23));
+        s = _mm_srai_epi32(_mm_add_epi32(s, round), shift);
+        s = _mm_packus_epi16(_mm_packs_epi32(s, s), s);
+        const int four = _mm_cvtsi128_si32(s);
+        memcpy(out + x, &four, 4);
+    }
+#endif
+    for (; x != width_; ++x) {
+        const uint16_t* in = sums + starts_[x];
+        const int16_t* weights = &weights_[x * OBS_TAPS];
+        int sum = 0;
+        for (int tap = 0; tap != OBS_TAPS; ++tap) sum += in[tap] * weights[tap];
+        out[x] = (uint8_t)((sum + (1 << (shift - 1))) >> shift);
+    }
+}
+
+// sums += line x weight, 256 columns
+static inline void AddLine(const uint8_t* line, int weight, uint16_t* sums){
+    if (!weight) return;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w = _mm_set1_epi16((short)weight);
+    for (int x = 0; x != 256; x += 16) {
+        const __m128i l = _mm_loadu_si128((const __m128i*)(line + x));
+        __m128i* s = (__m128i*)(sums + x);
+        _mm_storeu_si128(s, _mm_add_epi16(_mm_loadu_si128(s),
+            _mm_mullo_epi16(_mm_unpacklo_epi8(l, zero), w)));
+        _mm_storeu_si128(s + 1, _mm_add_epi16(_mm_loadu_si128(s + 1),
+            _mm_mullo_epi16(_mm_unpackhi_epi8(l, zero), w)));
+    }
+#else
+    for (int x = 0; x != 256; ++x) sums[x] = (uint16_t)(sums[x] + line[x] * weight);
+#endif
+}
+
+// Draws the background of the frame `fc` last ran line by line from the
+// nametables, with the frame's raster writes, as values[NES colour] per
+// pixel; sink(line, pixels) takes each line's 256 bytes.
+template<typename Sink>
+static void DrawLines(const PPU& ppu, const RasterState& start, const RasterWrite* log,
+    size_t count, const uint32_t* lut, const uint8_t* values, Sink sink){
+    RasterState state = start;
+    // the vertical scroll is only taken at the start of a frame
+    const unsigned top = state.scroll[1] + (state.ctrl >> 1 & 1) * 240;
+    // value of each background palette entry, in all 8 bytes
+    uint64_t colors[16];
+    bool changed = true;
+    size_t next = 0;
+    // 33 tiles, the line starts at the fine scroll
+    uint8_t pixels[33 * 8];
+    // pattern and palette of the tiles, kept for the 8 lines of a tile row
+    const uint8_t* tile_patterns[33];
+    const uint64_t* tile_palettes[33];
+    unsigned tiles_at = ~0u;
+
+    for (unsigned line = 0; line != 240; ++line) {
+        while (next != count && RasterLine(log[next]) <= line) {
+            ApplyRaster(log[next++], lut, state);
+            changed = true;
+        }
+        if (changed) {
+            // $3F04/8/C show $3F00
+            for (int i = 0; i != 16; ++i)
+                colors[i] = values[PpuPixel(state.spindexes[i & 3 ? i : 0], state.mask) & 0x3f] * BYTES;
+            changed = false;
+        }
+
+        const unsigned x = state.scroll[0] + (state.ctrl & 1) * 256;
+        // pattern table of this span, $2000 may switch it mid-frame
+        const unsigned table = (unsigned)BackgroundTable(state.ctrl);
+        if (!(state.mask & PPU2001_Back)) memset(pixels, (uint8_t)colors[0], sizeof(pixels));
+        else {
+            const unsigned y = (top + line) % 480;
+            // 240 is a whole number of tiles, so y / 8 is unique across quadrants
+            const unsigned at = table << 16 | y >> 3 << 8 | x >> 3;
+            if (at != tiles_at) {
+                tiles_at = at;
+                const unsigned quadrant_y = y >= 240 ? 2 : 0;
+                const unsigned tile_row = y % 240 >> 3;
+                for (unsigned tile = 0; tile != 33; ++tile) {
+                    const unsigned tx = ((x >> 3) + tile) & 63;
+                    const uint8_t* nt = ppu.banks[8 + quadrant_y + (tx >> 5)];
+                    const unsigned col = tx & 31;
+                    const unsigned name = nt[tile_row * 32 + col];
+                    const uint8_t attr = nt[32 * 30 + (tile_row >> 2) * 8 + (col >> 2)];
+                    const int shift = (col & 2) | ((tile_row & 2) << 1);
+                    tile_palettes[tile] = colors + ((attr >> shift & 3) << 2);
+                    tile_patterns[tile] = ppu.banks[table + (name >> 6)] + (name & 0x3f) * 16;
+                }
+            }
+            for (unsigned tile = 0; tile != 33; ++tile) {
+                const uint64_t* const palette = tile_palettes[tile];
+                const uint8_t* p0 = tile_patterns[tile] + (y & 7);
+                // the 8 pixels at once, picking each byte by the two planes
+                const uint64_t m0 = planes.masks[p0[0]];
+                const uint64_t m1 = planes.masks[p0[8]];
+                const uint64_t line8 = (palette[0] & ~m0 & ~m1) | (palette[1] & m0 & ~m1)
+                    | (palette[2] & ~m0 & m1) | (palette[3] & m0 & m1);
+                memcpy(pixels + tile * 8, &line8, 8);
+            }
+        }
+        sink(line, (const uint8_t*)pixels + (x & 7));
+    }
+}
+
+void ObservationRenderer::Render(const Famicom& fc, uint8_t* out) const{
+    uint16_t sums[2][256];
+    memset(sums, 0, sizeof(sums));
+    uint16_t* row_sums = sums[0];
+    uint16_t* next_sums = sums[1];
+    int row = 0;
+    DrawLines(fc.ppu_, fc.raster_start_, fc.raster_log_, fc.raster_count_, fc.palette_lut_, LumaLut(),
+        [&](unsigned line, const uint8_t* shown){
+            if (rows_[line] != row) {
+                FinishRow(row_sums, out + row * width_);
+                uint16_t* done = row_sums;
+                row_sums = next_sums;
+                next_sums = done;
+                memset(next_sums, 0, sizeof(sums[0]));
+                row = rows_[line];
+            }
+            AddLine(shown, row_weights_[line][0], row_sums);
+            AddLine(shown, row_weights_[line][1], next_sums);
+        });
+    FinishRow(row_sums, out + row * width_);
+}
+
+// NES colour i is i
+namespace {
+struct Identity
+{
+    uint8_t values[64];
+    Identity(){ for (int i = 0; i != 64; ++i) values[i] = (uint8_t)i; }
+};
+}
+static const Identity identity;
+
+void RenderIndices(const Famicom& fc, uint8_t* indices){
+    DrawLines(fc.ppu_, fc.raster_start_, fc.raster_log_, fc.raster_count_, fc.palette_lut_, identity.values,
+        [&](unsigned line, const uint8_t* shown){ memcpy(indices + line * 256, shown, 256); });
+}
+
+void MaxPool(const uint8_t* other, uint8_t* out, size_t size){
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= size; i += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(other + i));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(out + i));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_max_epu8(a, b));
+    }
+#endif
+    for (; i != size; ++i) if (other[i] > out[i]) out[i] = other[i];
+}
@@ -0,0 +1,55 @@
+#ifndef SFCE_OBS_H_
+#define SFCE_OBS_H_
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+class Famicom;
+
+enum
+{
+    OBS_TAPS        = 8,    // source columns an output column is read from
+    OBS_ROW_WEIGHT  = 64,   // weights of the lines of an output row sum to this
+    OBS_COL_WEIGHT  = 256,  // weights of the columns of an output pixel
+};
+
+// Downscaled 8-bit luminance of the background, for agents.
+// Lines are drawn tile by tile from the nametables with the frame's
+// raster writes, as palette entries through a 64-entry luma table, and
+// area filtered on the way: each line is added into the one or two output
+// rows it overlaps (SSE2, 16 columns at a time), and a finished row is
+// reduced to `width` pixels with one 8-tap multiply-add each. There is no
+// full-size frame and nothing is allocated per frame.
+class ObservationRenderer
+{
+private:
+    int     width_ = 0;
+    int     height_ = 0;
+    // per source line: first output row and the weights into it and the next
+    uint8_t rows_[240];
+    uint8_t row_weights_[240][2];
+    // per output pixel: first source column and OBS_TAPS weights
+    vector<uint16_t> starts_;
+    vector<int16_t> weights_;
+
+    void FinishRow(const uint16_t* sums, uint8_t* out) const;
+public:
+    // width 64-256, height 60-240, e.g. 84x84 or 128x120
+    int Init(int width, int height);
+    int Width() const { return width_; }
+    int Height() const { return height_; }
+    size_t Size() const { return (size_t)width_ * height_; }
+    // the frame `fc` last ran, Size() bytes into `out`; thread-safe
+    void Render(const Famicom& fc, uint8_t* out) const;
+};
+
+// 256x240 NES colour indices (0-63) of the background of the frame `fc`
+// last ran, drawn like ObservationRenderer: scrolled and with the frame's
+// raster writes; thread-safe
+void RenderIndices(const Famicom& fc, uint8_t* indices);
+
+// out = max(out, other) per byte, pooling an observation over two frames
+void MaxPool(const uint8_t* other, uint8_t* out, size_t size);
+
+#endif
@@ -0,0 +1,67 @@
+#include "palette.h"
+
+union PaletteData {
+    struct{uint8_t r, g, b, a;};
+    uint32_t data;
+};
+
+static const PaletteData palette[64] = {
+    { 0x7F, 0x7F, 0x7F, 0xFF }, { 0x20, 0x00, 0xB0, 0xFF }, { 0x28, 0x00, 0xB8, 0xFF }, { 0x60, 0x10, 0xA0, 0xFF },
+    { 0x98, 0x20, 0x78, 0xFF }, { 0xB0, 0x10, 0x30, 0xFF }, { 0xA0, 0x30, 0x00, 0xFF }, { 0x78, 0x40, 0x00, 0xFF },
+    { 0x48, 0x58, 0x00, 0xFF }, { 0x38, 0x68, 0x00, 0xFF }, { 0x38, 0x6C, 0x00, 0xFF }, { 0x30, 0x60, 0x40, 0xFF },
+    { 0x30, 0x50, 0x80, 0xFF }, { 0x00, 0x00, 0x00, 0xFF }, { 0x00, 0x00, 0x00, 0xFF }, { 0x00, 0x00, 0x00, 0xFF },
+
+    { 0xBC, 0xBC, 0xBC, 0xFF }, { 0x40, 0x60, 0xF8, 0xFF }, { 0x40, 0x40, 0xFF, 0xFF }, { 0x90, 0x40, 0xF0, 0xFF },
+    { 0xD8, 0x40, 0xC0, 0xFF }, { 0xD8, 0x40, 0x60, 0xFF }, { 0xE0, 0x50, 0x00, 0xFF }, { 0xC0, 0x70, 0x00, 0xFF },
+    { 0x88, 0x88, 0x00, 0xFF }, { 0x50, 0xA0, 0x00, 0xFF }, { 0x48, 0xA8, 0x10, 0xFF }, { 0x48, 0xA0, 0x68, 0xFF },
+    { 0x40, 0x90, 0xC0, 0xFF }, { 0x00, 0x00, 0x00, 0xFF }, { 0x00, 0x00, 0x00, 0xFF }, { 0x00, 0x00, 0x00, 0xFF },
+
+    { 0xFF, 0xFF, 0xFF, 0xFF }, { 0x60, 0xA0, 0xFF, 0xFF }, { 0x50, 0x80, 0xFF, 0xFF }, { 0xA0, 0x70, 0xFF, 0xFF },
+    { 0xF0, 0x60, 0xFF, 0xFF }, { 0xFF, 0x60, 0xB0, 0xFF }, { 0xFF, 0x78, 0x30, 0xFF }, { 0xFF, 0xA0, 0x00, 0xFF },
+    { 0xE8, 0xD0, 0x20, 0xFF }, { 0x98, 0xE8, 0x00, 0xFF }, { 0x70, 0xF0, 0x40, 0xFF }, { 0x70, 0xE0, 0x90, 0xFF },
+    { 0x60, 0xD0, 0xE0, 0xFF }, { 0x60, 0x60, 0x60, 0xFF }, { 0x00, 0x00, 0x00, 0xFF }, { 0x00, 0x00, 0x00, 0xFF },
+
+    { 0xFF, 0xFF, 0xFF, 0xFF }, { 0x90, 0xD0, 0xFF, 0xFF }, { 0xA0, 0xB8, 0xFF, 0xFF }, { 0xC0, 0xB0, 0xFF, 0xFF },
+    { 0xE0, 0xB0, 0xFF, 0xFF }, { 0xFF, 0xB8, 0xE8, 0xFF }, { 0xFF, 0xC8, 0xB8, 0xFF }, { 0xFF, 0xD8, 0xA0, 0xFF },
+    { 0xFF, 0xF0, 0x90, 0xFF }, { 0xC8, 0xF0, 0x80, 0xFF }, { 0xA0, 0xF0, 0xA0, 0xFF }, { 0xA0, 0xFF, 0xC8, 0xFF },
+    { 0xA0, 0xFF, 0xF0, 0xFF }, { 0xA0, 0xA0, 0xA0, 0xFF }, { 0x00, 0x00, 0x00, 0xFF }, { 0x00, 0x00, 0x00, 0xFF }
+};
+
+// each emphasis bit attenuates the other two channels, as it does a third
+// of the colour cycle in the composite signal (see ntsc.cpp)
+static const int ATTENUATION = 191;     // 0.746 * 256
+
+namespace {
+struct PaletteLuts
+{
+    uint32_t colors[PIXEL_FORMAT_COUNT][512];
+    uint8_t  luma[64];
+    PaletteLuts(){
+        for (int i = 0; i != 64; ++i)
+            luma[i] = (uint8_t)((77 * palette[i].r + 150 * palette[i].g + 29 * palette[i].b + 128) >> 8);
+        for (int pixel = 0; pixel != 512; ++pixel) {
+            const PaletteData color = palette[pixel & 0x3f];
+            const int emphasis = pixel >> 6;
+            int rgb[3] = { color.r, color.g, color.b };
+            for (int c = 0; c != 3; ++c)
+                for (int bit = 0; bit != 3; ++bit)
+                    if ((emphasis >> bit & 1) && bit != c) rgb[c] = rgb[c] * ATTENUATION >> 8;
+            colors[PIXEL_RGBA][pixel] = 0xff000000 | rgb[2] << 16 | rgb[1] << 8 | rgb[0];
+            colors[PIXEL_BGRA][pixel] = 0xff000000 | rgb[0] << 16 | rgb[1] << 8 | rgb[2];
+        }
+    }
+};
+}
+
+static const PaletteLuts& Luts(){
+    static const PaletteLuts luts;
+    return luts;
+}
+
+const uint32_t* PaletteLut(int format){
+    return Luts().colors[format];
+}
+
+const uint8_t* LumaLut(){
+    return Luts().luma;
+}
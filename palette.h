@@ -0,0 +1,31 @@
+#ifndef SFCE_PALETTE_H_
+#define SFCE_PALETTE_H_
+#include <cstdint>
+using namespace std;
+
+// output pixel formats, by byte order in memory
+enum
+{
+    PIXEL_RGBA = 0,     // video, hashes and filters
+    PIXEL_BGRA,         // SDL ARGB8888/RGB888 surfaces
+    PIXEL_FORMAT_COUNT,
+};
+
+// PPU pixel: colour index (0-63) | emphasis bits of $2001 << 6, with
+// grayscale ($2001 bit 0) already applied to the index
+inline uint16_t PpuPixel(uint8_t color, uint8_t mask){
+    return (uint16_t)((color & (mask & 1 ? 0x30 : 0x3f)) | (mask >> 5) << 6);
+}
+
+// 512 colours in `format`, indexed by PpuPixel(), built once
+const uint32_t* PaletteLut(int format);
+// BT.601 luma (0-255) of the 64 NES colours
+const uint8_t* LumaLut();
+
+// colour palette entry `index` (0-31) is shown in: $3F04/8/C and their
+// mirrors show the backdrop
+inline uint32_t ShownColor(const uint32_t* lut, const uint8_t* spindexes, uint8_t mask, int index){
+    return lut[PpuPixel(spindexes[index & 3 ? index : 0], mask)];
+}
+
+#endif
@@ -0,0 +1,38 @@
+#include "pool.h"
+#include "famicom.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <new>
+
+FamicomPool::FamicomPool(size_t capacity){
+    stride_ = (sizeof(Famicom) + 63) & ~(size_t)63;
+    void* block = nullptr;
+    if (capacity && posix_memalign(&block, 64, stride_ * capacity) == 0) {
+        block_ = (uint8_t*)block;
+        capacity_ = capacity;
+    }
+    // lowest slot first
+    free_.reserve(capacity_);
+    for (size_t i = capacity_; i != 0; --i) free_.push_back((uint32_t)(i - 1));
+}
+
+FamicomPool::~FamicomPool(){
+    // every instance must have been destroyed
+    assert(free_.size() == capacity_);
+    free(block_);
+}
+
+Famicom* FamicomPool::Create(){
+    if (free_.empty()) return nullptr;
+    const uint32_t slot = free_.back();
+    free_.pop_back();
+    return new (block_ + stride_ * slot) Famicom();
+}
+
+void FamicomPool::Destroy(Famicom* famicom){
+    if (!famicom) return;
+    const size_t offset = (size_t)((uint8_t*)famicom - block_);
+    assert(offset < stride_ * capacity_ && offset % stride_ == 0);
+    famicom->~Famicom();
+    free_.push_back((uint32_t)(offset / stride_));
+}
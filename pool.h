@@ -0,0 +1,34 @@
+#ifndef SFCE_POOL_H_
+#define SFCE_POOL_H_
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+class Famicom;
+
+// Slab of Famicom instances for hosting many machines in one process.
+// One allocation holds every slot, each slot starts on a cache line, so
+// the hot cpu state (Famicom's first member) never shares a line with
+// another instance. Instances started with Famicom::Init(source) share
+// the ROM of `source`.
+class FamicomPool
+{
+private:
+    uint8_t*        block_ = nullptr;
+    // slot size, sizeof(Famicom) rounded up to a cache line
+    size_t          stride_ = 0;
+    size_t          capacity_ = 0;
+    vector<uint32_t> free_;
+public:
+    explicit FamicomPool(size_t capacity);
+    ~FamicomPool();
+    // constructs an instance in a free slot, null when the pool is full
+    Famicom* Create();
+    void Destroy(Famicom*);
+    size_t Capacity() const { return capacity_; }
+    size_t Used() const { return capacity_ - free_.size(); }
+    size_t Stride() const { return stride_; }
+};
+
+#endif
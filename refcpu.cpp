@@ -0,0 +1,314 @@
+#include "refcpu.h"
+#include "code.h"
+#include "cpu.h"
+
+enum
+{
+    P_C = 0x01,
+    P_Z = 0x02,
+    P_I = 0x04,
+    P_D = 0x08,
+    P_B = 0x10,
+    P_R = 0x20,
+    P_V = 0x40,
+    P_N = 0x80,
+};
+
+// documented NMOS 6502 cycle counts, without page-cross/branch penalties
+static const uint8_t REF_CYCLES[256] = {
+    7,6,2,8,3,3,5,5,3,2,2,2,4,4,6,6,
+    2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,
+    6,6,2,8,3,3,5,5,4,2,2,2,4,4,6,6,
+    2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,
+    6,6,2,8,3,3,5,5,3,2,2,2,3,4,6,6,
+    2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,
+    6,6,2,8,3,3,5,5,4,2,2,2,5,4,6,6,
+    2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,
+    2,6,2,6,3,3,3,3,2,2,2,2,4,4,4,4,
+    2,6,2,6,4,4,4,4,2,5,2,5,5,5,5,5,
+    2,6,2,6,3,3,3,3,2,2,2,2,4,4,4,4,
+    2,5,2,5,4,4,4,4,2,4,2,4,4,4,4,4,
+    2,6,2,8,3,3,5,5,2,2,2,2,4,4,6,6,
+    2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,
+    2,6,2,8,3,3,5,5,2,2,2,2,4,4,6,6,
+    2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,
+};
+
+#define NAME(a, b, c) ((uint32_t)(a) << 16 | (uint32_t)(b) << 8 | (uint32_t)(c))
+
+static inline uint32_t NameOf(uint8_t opcode){
+    const OpName& op = OPNAMEDATA[opcode];
+    return NAME(op.name[0], op.name[1], op.name[2]);
+}
+
+// read instructions that take one more cycle when indexing crosses a page
+static bool PagePenalty(uint8_t opcode){
+    const uint8_t mode = OPNAMEDATA[opcode].mode;
+    if (mode != AM_ABX && mode != AM_ABY && mode != AM_INY) return false;
+    switch (NameOf(opcode)) {
+    case NAME('A','D','C'): case NAME('A','N','D'): case NAME('C','M','P'):
+    case NAME('E','O','R'): case NAME('L','D','A'): case NAME('L','D','X'):
+    case NAME('L','D','Y'): case NAME('O','R','A'): case NAME('S','B','C'):
+    case NAME('L','A','X'): case NAME('N','O','P'):
+        return true;
+    }
+    return false;
+}
+
+bool RefCpu::Supported(uint8_t opcode){
+    return Cpu::Decodes(opcode);
+}
+
+uint8_t RefCpu::Read(uint16_t address){
+    return bus_->read(bus_->context, address);
+}
+
+void RefCpu::Write(uint16_t address, uint8_t data){
+    bus_->write(bus_->context, address, data);
+}
+
+void RefCpu::Push(uint8_t data){
+    Write((uint16_t)(0x100 | sp), data);
+    --sp;
+}
+
+uint8_t RefCpu::Pull(){
+    ++sp;
+    return Read((uint16_t)(0x100 | sp));
+}
+
+void RefCpu::SetFlag(uint8_t flag, bool on){
+    p = on ? (uint8_t)(p | flag) : (uint8_t)(p & ~flag);
+}
+
+void RefCpu::SetZN(uint8_t value){
+    SetFlag(P_Z, value == 0);
+    SetFlag(P_N, (value & 0x80) != 0);
+}
+
+void RefCpu::Compare(uint8_t reg, uint8_t value){
+    SetFlag(P_C, reg >= value);
+    SetZN((uint8_t)(reg - value));
+}
+
+void RefCpu::Adc(uint8_t value){
+    // the NES 6502 has no decimal mode
+    const unsigned sum = (unsigned)a + value + (p & P_C);
+    const uint8_t result = (uint8_t)sum;
+    SetFlag(P_C, sum > 0xff);
+    SetFlag(P_V, ((a ^ result) & (value ^ result) & 0x80) != 0);
+    a = result;
+    SetZN(a);
+}
+
+int RefCpu::Step(const RefBus& bus){
+    bus_ = &bus;
+    const uint8_t opcode = Read(pc);
+    if (!Supported(opcode)) return 0;
+    ++pc;
+    int cycles = REF_CYCLES[opcode];
+
+    // effective address
+    uint16_t address = 0;
+    bool crossed = false;
+    switch (OPNAMEDATA[opcode].mode) {
+    case AM_IMM:
+        address = pc++;
+        break;
+    case AM_ZPG:
+        address = Read(pc++);
+        break;
+    case AM_ZPX:
+        address = (uint8_t)(Read(pc++) + x);
+        break;
+    case AM_ZPY:
+        address = (uint8_t)(Read(pc++) + y);
+        break;
+    case AM_ABS:
+    case AM_ABX:
+    case AM_ABY:
+    {
+        const uint8_t lo = Read(pc++);
+        const uint8_t hi = Read(pc++);
+        const uint16_t base = (uint16_t)(lo | hi << 8);
+        const uint8_t mode = OPNAMEDATA[opcode].mode;
+        address = (uint16_t)(base + (mode == AM_ABX ? x : mode == AM_ABY ? y : 0));
+        crossed = (base >> 8) != (address >> 8);
+        break;
+    }
+    case AM_INX:
+    {
+        const uint8_t zp = (uint8_t)(Read(pc++) + x);
+        const uint8_t lo = Read(zp);
+        const uint8_t hi = Read((uint8_t)(zp + 1));
+        address = (uint16_t)(lo | hi << 8);
+        break;
+    }
+    case AM_INY:
+    {
+        const uint8_t zp = Read(pc++);
+        const uint8_t lo = Read(zp);
+        const uint8_t hi = Read((uint8_t)(zp + 1));
+        const uint16_t base = (uint16_t)(lo | hi << 8);
+        address = (uint16_t)(base + y);
+        crossed = (base >> 8) != (address >> 8);
+        break;
+    }
+    case AM_IND:
+    {
+        const uint8_t lo = Read(pc++);
+        const uint8_t hi = Read(pc++);
+        // the pointer's high byte does not carry into the next page
+        const uint8_t tlo = Read((uint16_t)(lo | hi << 8));
+        const uint8_t thi = Read((uint16_t)((uint8_t)(lo + 1) | hi << 8));
+        address = (uint16_t)(tlo | thi << 8);
+        break;
+    }
+    case AM_REL:
+    {
+        const int8_t offset = (int8_t)Read(pc++);
+        address = (uint16_t)(pc + offset);
+        break;
+    }
+    }
+    if (crossed && PagePenalty(opcode)) ++cycles;
+
+    bool branch = false;
+    switch (NameOf(opcode)) {
+    // loads and stores
+    case NAME('L','D','A'): a = Read(address); SetZN(a); break;
+    case NAME('L','D','X'): x = Read(address); SetZN(x); break;
+    case NAME('L','D','Y'): y = Read(address); SetZN(y); break;
+    case NAME('L','A','X'): a = x = Read(address); SetZN(a); break;
+    case NAME('S','T','A'): Write(address, a); break;
+    case NAME('S','T','X'): Write(address, x); break;
+    case NAME('S','T','Y'): Write(address, y); break;
+    case NAME('S','A','X'): Write(address, (uint8_t)(a & x)); break;
+    // transfers
+    case NAME('T','A','X'): x = a; SetZN(x); break;
+    case NAME('T','A','Y'): y = a; SetZN(y); break;
+    case NAME('T','X','A'): a = x; SetZN(a); break;
+    case NAME('T','Y','A'): a = y; SetZN(a); break;
+    case NAME('T','S','X'): x = sp; SetZN(x); break;
+    case NAME('T','X','S'): sp = x; break;
+    // stack
+    case NAME('P','H','A'): Push(a); break;
+    case NAME('P','H','P'): Push((uint8_t)(p | P_B | P_R)); break;
+    case NAME('P','L','A'): a = Pull(); SetZN(a); break;
+    case NAME('P','L','P'): p = (uint8_t)((Pull() & ~P_B) | P_R); break;
+    // logic and arithmetic
+    case NAME('A','N','D'): a &= Read(address); SetZN(a); break;
+    case NAME('O','R','A'): a |= Read(address); SetZN(a); break;
+    case NAME('E','O','R'): a ^= Read(address); SetZN(a); break;
+    case NAME('A','D','C'): Adc(Read(address)); break;
+    case NAME('S','B','C'): Adc((uint8_t)~Read(address)); break;
+    case NAME('C','M','P'): Compare(a, Read(address)); break;
+    case NAME('C','P','X'): Compare(x, Read(address)); break;
+    case NAME('C','P','Y'): Compare(y, Read(address)); break;
+    case NAME('B','I','T'):
+    {
+        const uint8_t value = Read(address);
+        SetFlag(P_Z, (a & value) == 0);
+        SetFlag(P_N, (value & 0x80) != 0);
+        SetFlag(P_V, (value & 0x40) != 0);
+        break;
+    }
+    // increments
+    case NAME('I','N','X'): SetZN(++x); break;
+    case NAME('I','N','Y'): SetZN(++y); break;
+    case NAME('D','E','X'): SetZN(--x); break;
+    case NAME('D','E','Y'): SetZN(--y); break;
+    case NAME('I','N','C'): case NAME('D','E','C'):
+    case NAME('I','S','B'): case NAME('D','C','P'):
+    {
+        const bool up = NameOf(opcode) == NAME('I','N','C') || NameOf(opcode) == NAME('I','S','B');
+        const uint8_t value = (uint8_t)(Read(address) + (up ? 1 : -1));
+        Write(address, value);
+        SetZN(value);
+        if (NameOf(opcode) == NAME('I','S','B')) Adc((uint8_t)~value);
+        if (NameOf(opcode) == NAME('D','C','P')) Compare(a, value);
+        break;
+    }
+    // shifts, on A or memory, and the shift+ALU combinations
+    case NAME('A','S','L'): case NAME('L','S','R'): case NAME('R','O','L'): case NAME('R','O','R'):
+    case NAME('S','L','O'): case NAME('S','R','E'): case NAME('R','L','A'): case NAME('R','R','A'):
+    {
+        const uint32_t name = NameOf(opcode);
+        const bool accumulator = OPNAMEDATA[opcode].mode == AM_ACC;
+        const uint8_t value = accumulator ? a : Read(address);
+        const uint8_t carry = p & P_C;
+        uint8_t result;
+        if (name == NAME('A','S','L') || name == NAME('S','L','O')) {
+            SetFlag(P_C, (value & 0x80) != 0);
+            result = (uint8_t)(value << 1);
+        }
+        else if (name == NAME('L','S','R') || name == NAME('S','R','E')) {
+            SetFlag(P_C, (value & 0x01) != 0);
+            result = (uint8_t)(value >> 1);
+        }
+        else if (name == NAME('R','O','L') || name == NAME('R','L','A')) {
+            SetFlag(P_C, (value & 0x80) != 0);
+            result = (uint8_t)(value << 1 | carry);
+        }
+        else {
+            SetFlag(P_C, (value & 0x01) != 0);
+            result = (uint8_t)(value >> 1 | carry << 7);
+        }
+        SetZN(result);
+        if (accumulator) a = result;
+        else Write(address, result);
+        if (name == NAME('S','L','O')) { a |= result; SetZN(a); }
+        if (name == NAME('S','R','E')) { a ^= result; SetZN(a); }
+        if (name == NAME('R','L','A')) { a &= result; SetZN(a); }
+        if (name == NAME('R','R','A')) Adc(result);
+        break;
+    }
+    // flags
+    case NAME('C','L','C'): SetFlag(P_C, false); break;
+    case NAME('S','E','C'): SetFlag(P_C, true); break;
+    case NAME('C','L','I'): SetFlag(P_I, false); break;
+    case NAME('S','E','I'): SetFlag(P_I, true); break;
+    case NAME('C','L','D'): SetFlag(P_D, false); break;
+    case NAME('S','E','D'): SetFlag(P_D, true); break;
+    case NAME('C','L','V'): SetFlag(P_V, false); break;
+    // control flow
+    case NAME('J','M','P'): pc = address; break;
+    case NAME('J','S','R'):
+        --pc;
+        Push((uint8_t)(pc >> 8));
+        Push((uint8_t)pc);
+        pc = address;
+        break;
+    case NAME('R','T','S'):
+    {
+        const uint8_t lo = Pull();
+        const uint8_t hi = Pull();
+        pc = (uint16_t)((lo | hi << 8) + 1);
+        break;
+    }
+    case NAME('R','T','I'):
+    {
+        p = (uint8_t)((Pull() & ~P_B) | P_R);
+        const uint8_t lo = Pull();
+        const uint8_t hi = Pull();
+        pc = (uint16_t)(lo | hi << 8);
+        break;
+    }
+    case NAME('B','C','C'): branch = !(p & P_C); break;
+    case NAME('B','C','S'): branch = (p & P_C) != 0; break;
+    case NAME('B','N','E'): branch = !(p & P_Z); break;
+    case NAME('B','E','Q'): branch = (p & P_Z) != 0; break;
+    case NAME('B','P','L'): branch = !(p & P_N); break;
+    case NAME('B','M','I'): branch = (p & P_N) != 0; break;
+    case NAME('B','V','C'): branch = !(p & P_V); break;
+    case NAME('B','V','S'): branch = (p & P_V) != 0; break;
+    case NAME('N','O','P'):
+        // operands are decoded but never read, like Cpu
+        break;
+    }
+    if (branch) {
+        cycles += ((pc ^ address) & 0xff00) ? 2 : 1;
+        pc = address;
+    }
+    return cycles;
+}
@@ -0,0 +1,42 @@
+#ifndef SFCE_REFCPU_H_
+#define SFCE_REFCPU_H_
+#include <cstdint>
+
+// memory callbacks for the reference core
+struct RefBus
+{
+    void*   context;
+    uint8_t (*read)(void* context, uint16_t address);
+    void    (*write)(void* context, uint16_t address, uint8_t data);
+};
+
+// Plain reference 6502 interpreter for differential testing.
+// Written for clarity, not speed: packed status byte, decoding driven by
+// OPNAMEDATA, its own cycle table. It decodes exactly the opcodes Cpu
+// implements.
+class RefCpu
+{
+private:
+    const RefBus* bus_ = nullptr;
+    uint8_t  Read(uint16_t address);
+    void     Write(uint16_t address, uint8_t data);
+    void     Push(uint8_t data);
+    uint8_t  Pull();
+    void     SetZN(uint8_t value);
+    void     SetFlag(uint8_t flag, bool on);
+    void     Compare(uint8_t reg, uint8_t value);
+    void     Adc(uint8_t value);
+public:
+    uint16_t pc = 0;
+    uint8_t  a = 0;
+    uint8_t  x = 0;
+    uint8_t  y = 0;
+    uint8_t  sp = 0;
+    uint8_t  p = 0;
+
+    static bool Supported(uint8_t opcode);
+    // executes one instruction, returns its cpu cycles (0: not supported)
+    int Step(const RefBus& bus);
+};
+
+#endif
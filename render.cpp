@@ -0,0 +1,87 @@
+#include "render.h"
+
+RenderWorker::RenderWorker(){
+    failed_ = false;
+}
+
+RenderWorker::~RenderWorker(){
+    Finish();
+}
+
+void RenderWorker::Start(Rasterizer draw, FrameSink sink, int slots){
+    Finish();
+    draw_ = draw;
+    sink_ = sink;
+    pool_.resize(slots);
+    free_.clear();
+    for (int i = 0; i != slots; ++i) free_.push_back(i);
+    queue_.assign(slots, 0);
+    head_ = 0;
+    count_ = 0;
+    closing_ = false;
+    failed_ = false;
+    frames_ = 0;
+    stalls_ = 0;
+    pixels_.resize(256 * 240);
+    frame_.resize(256 * 240);
+    if (!cache_) cache_.reset(new BackgroundCache());
+    running_ = true;
+    worker_ = thread(&RenderWorker::Worker, this);
+}
+
+void RenderWorker::Submit(Famicom& fc, uint64_t state_hash){
+    if (!running_) return;
+    int index;
+    {
+        unique_lock<mutex> guard(lock_);
+        if (free_.empty()) {
+            ++stalls_;
+            released_.wait(guard, [this]{ return !free_.empty(); });
+        }
+        index = free_.back();
+        free_.pop_back();
+    }
+    CaptureRenderInputs(fc, pool_[index]);
+    pool_[index].state_hash = state_hash;
+    {
+        lock_guard<mutex> guard(lock_);
+        queue_[(head_ + count_) % queue_.size()] = index;
+        ++count_;
+        ++frames_;
+    }
+    ready_.notify_one();
+}
+
+void RenderWorker::Worker(){
+    for (;;) {
+        int index;
+        {
+            unique_lock<mutex> guard(lock_);
+            ready_.wait(guard, [this]{ return count_ || closing_; });
+            if (!count_) return;
+            index = queue_[head_];
+            head_ = (head_ + 1) % queue_.size();
+            --count_;
+        }
+        // frames after a failure are drawn but dropped
+        draw_(pool_[index], *cache_, pixels_.data(), frame_.data());
+        if (!failed_ && !sink_(pool_[index], pixels_.data(), frame_.data())) failed_ = true;
+        {
+            lock_guard<mutex> guard(lock_);
+            free_.push_back(index);
+        }
+        released_.notify_one();
+    }
+}
+
+void RenderWorker::Finish(){
+    if (!running_) return;
+    {
+        lock_guard<mutex> guard(lock_);
+        closing_ = true;
+    }
+    ready_.notify_one();
+    // the worker drains the queue before leaving
+    worker_.join();
+    running_ = false;
+}
@@ -0,0 +1,66 @@
+#ifndef SFCE_RENDER_H_
+#define SFCE_RENDER_H_
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include "bgcache.h"
+using namespace std;
+
+// draws one 256x240 frame, as PPU pixels and RGBA
+typedef void (*Rasterizer)(const RenderInputs& inputs, BackgroundCache& cache,
+    uint16_t* pixels, uint32_t* rgba);
+// takes a finished frame, false stops the run (e.g. a hash mismatch)
+typedef bool (*FrameSink)(const RenderInputs& inputs, const uint16_t* pixels, const uint32_t* rgba);
+
+// Pipelined rendering.
+// Submit() captures the render inputs of the frame that just ended into a
+// pooled slot and returns, a worker thread rasterizes the frames in order
+// with its own background cache and passes them to the sink. Like
+// VideoWriter, the caller only waits when every slot is still queued.
+class RenderWorker
+{
+private:
+    Rasterizer  draw_ = nullptr;
+    FrameSink   sink_ = nullptr;
+    bool        running_ = false;
+
+    vector<RenderInputs> pool_;
+    vector<int>     free_;
+    vector<int>     queue_;
+    size_t          head_ = 0;
+    size_t          count_ = 0;
+    bool            closing_ = false;
+    mutex           lock_;
+    condition_variable ready_;
+    condition_variable released_;
+    thread          worker_;
+    atomic<bool>    failed_;
+
+    vector<uint16_t> pixels_;
+    vector<uint32_t> frame_;
+    // the plane is 240KB, kept off this object
+    unique_ptr<BackgroundCache> cache_;
+
+    uint64_t frames_ = 0;
+    uint64_t stalls_ = 0;
+
+    void Worker();
+public:
+    RenderWorker();
+    ~RenderWorker();
+    void Start(Rasterizer draw, FrameSink sink, int slots = 4);
+    bool IsRunning() const { return running_; }
+    // `state_hash` travels with the frame to the sink
+    void Submit(Famicom& fc, uint64_t state_hash);
+    // waits for every submitted frame
+    void Finish();
+    bool Failed() const { return failed_; }
+    uint64_t Frames() const { return frames_; }
+    uint64_t Stalls() const { return stalls_; }
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "scheduler.h"
+#include <assert.h>
+
+// heap order: earlier cycle first, ties broken by event type
+static inline bool Before(const Event& a, const Event& b){
+    return a.cycle < b.cycle || (a.cycle == b.cycle && a.type < b.type);
+}
+
+Scheduler::Scheduler(){
+    Clear();
+}
+
+void Scheduler::Clear(){
+    size_ = 0;
+    for (int i = 0; i != EVENT_COUNT; ++i) slot_[i] = -1;
+}
+
+void Scheduler::Swap(int a, int b){
+    const Event temp = heap_[a];
+    heap_[a] = heap_[b];
+    heap_[b] = temp;
+    slot_[heap_[a].type] = (int8_t)a;
+    slot_[heap_[b].type] = (int8_t)b;
+}
+
+void Scheduler::SiftUp(int i){
+    while (i > 0) {
+        const int parent = (i - 1) >> 1;
+        if (!Before(heap_[i], heap_[parent])) break;
+        Swap(i, parent);
+        i = parent;
+    }
+}
+
+void Scheduler::SiftDown(int i){
+    for (;;) {
+        const int left = i * 2 + 1;
+        const int right = left + 1;
+        int min = i;
+        if (left < size_ && Before(heap_[left], heap_[min])) min = left;
+        if (right < size_ && Before(heap_[right], heap_[min])) min = right;
+        if (min == i) break;
+        Swap(i, min);
+        i = min;
+    }
+}
+
+void Scheduler::RemoveAt(int i){
+    slot_[heap_[i].type] = -1;
+    --size_;
+    if (i == size_) return;
+    heap_[i] = heap_[size_];
+    slot_[heap_[i].type] = (int8_t)i;
+    SiftUp(i);
+    SiftDown(slot_[heap_[i].type]);
+}
+
+void Scheduler::Schedule(uint8_t type, uint64_t cycle){
+    assert(type < EVENT_COUNT);
+    int i = slot_[type];
+    if (i < 0) {
+        i = size_++;
+        heap_[i].type = type;
+        slot_[type] = (int8_t)i;
+    }
+    heap_[i].cycle = cycle;
+    SiftUp(i);
+    SiftDown(slot_[type]);
+}
+
+void Scheduler::Cancel(uint8_t type){
+    assert(type < EVENT_COUNT);
+    if (slot_[type] >= 0) RemoveAt(slot_[type]);
+}
+
+bool Scheduler::Pop(uint64_t now, Event& event){
+    if (!size_ || heap_[0].cycle > now) return false;
+    event = heap_[0];
+    RemoveAt(0);
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef SFCE_SCHEDULER_H_
+#define SFCE_SCHEDULER_H_
+#include <cstdint>
+
+// master clock (NTSC)
+// 1 CPU cycle = 12 master cycles, 1 PPU dot = 4 master cycles
+enum : uint32_t
+{
+    MASTER_PER_CPU   = 12,
+    MASTER_PER_DOT   = 4,
+    DOTS_PER_LINE    = 341,
+    LINES_PER_FRAME  = 262,
+    MASTER_PER_LINE  = MASTER_PER_DOT * DOTS_PER_LINE,
+    MASTER_PER_FRAME = MASTER_PER_LINE * LINES_PER_FRAME,
+
+    LINE_VBLANK      = 241, // VBlank开始扫描线
+    LINE_PRERENDER   = 261, // 预渲染扫描线, VBlank结束
+};
+
+// event type, at most one pending deadline per type
+enum
+{
+    EVENT_VBLANK_START = 0, // VBlank开始(241, 1)
+    EVENT_VBLANK_END,       // VBlank结束(261, 1)
+    EVENT_NMI,              // 不可屏蔽中断
+    EVENT_SPRITE0_HIT,      // 零号精灵命中
+    EVENT_MAPPER_IRQ,       // Mapper中断
+    EVENT_APU_FRAME_IRQ,    // APU帧计数器中断
+    EVENT_DMA,              // OAM DMA($4014)
+    EVENT_FRAME_END,        // 一帧结束
+    EVENT_COUNT
+};
+
+static const uint64_t EVENT_NEVER = ~(uint64_t)0;
+
+struct Event
+{
+    uint64_t cycle;
+    uint8_t  type;
+};
+
+// Fixed size binary min-heap keyed by master cycle.
+// No allocation: every event type owns one slot, rescheduling moves it.
+class Scheduler
+{
+private:
+    Event   heap_[EVENT_COUNT];
+    int8_t  slot_[EVENT_COUNT];
+    uint8_t size_ = 0;
+
+    void Swap(int, int);
+    void SiftUp(int);
+    void SiftDown(int);
+    void RemoveAt(int);
+public:
+    Scheduler();
+    void Clear();
+    // (re)schedule an event, replaces the pending one of the same type
+    void Schedule(uint8_t type, uint64_t cycle);
+    void Cancel(uint8_t type);
+    bool Pending(uint8_t type) const { return slot_[type] >= 0; }
+    uint64_t Deadline(uint8_t type) const {
+        return slot_[type] >= 0 ? heap_[slot_[type]].cycle : EVENT_NEVER;
+    }
+    uint64_t NextDeadline() const { return size_ ? heap_[0].cycle : EVENT_NEVER; }
+    // pop the earliest event due at or before `now`
+    bool Pop(uint64_t now, Event& event);
+};
+
+#endif
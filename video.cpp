@@ -0,0 +1,179 @@
+#include "video.h"
+#include "code.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// pixels are PaletteData: r, g, b, a in memory order
+static inline void YuvScalar(uint32_t px, uint8_t* y, uint8_t* u, uint8_t* v){
+    const int r = px & 0xff;
+    const int g = (px >> 8) & 0xff;
+    const int b = (px >> 16) & 0xff;
+    *y = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    *u = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    *v = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+void RgbaToYuv444(const uint32_t* rgba, size_t count, uint8_t* y, uint8_t* u, uint8_t* v){
+    size_t i = 0;
+#ifdef __SSE2__
+    // 8 pixels per step, 16-bit lanes
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i round = _mm_set1_epi16(128);
+    const __m128i y_off = _mm_set1_epi16(16);
+    const __m128i c_off = _mm_set1_epi16(128);
+    for (; i + 8 <= count; i += 8) {
+        const __m128i p0 = _mm_loadu_si128((const __m128i*)(rgba + i));
+        const __m128i p1 = _mm_loadu_si128((const __m128i*)(rgba + i + 4));
+        const __m128i r = _mm_packs_epi32(_mm_and_si128(p0, mask), _mm_and_si128(p1, mask));
+        const __m128i g = _mm_packs_epi32(
+            _mm_and_si128(_mm_srli_epi32(p0, 8), mask), _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+        const __m128i b = _mm_packs_epi32(
+            _mm_and_si128(_mm_srli_epi32(p0, 16), mask), _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+
+        // all Y terms are positive and fit in 16 unsigned bits
+        __m128i ty = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+            _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+        ty = _mm_add_epi16(ty, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+        ty = _mm_add_epi16(_mm_srli_epi16(_mm_add_epi16(ty, round), 8), y_off);
+
+        __m128i tu = _mm_sub_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(112)),
+            _mm_mullo_epi16(r, _mm_set1_epi16(38)));
+        tu = _mm_sub_epi16(tu, _mm_mullo_epi16(g, _mm_set1_epi16(74)));
+        tu = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(tu, round), 8), c_off);
+
+        __m128i tv = _mm_sub_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(112)),
+            _mm_mullo_epi16(g, _mm_set1_epi16(94)));
+        tv = _mm_sub_epi16(tv, _mm_mullo_epi16(b, _mm_set1_epi16(18)));
+        tv = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(tv, round), 8), c_off);
+
+        _mm_storel_epi64((__m128i*)(y + i), _mm_packus_epi16(ty, ty));
+        _mm_storel_epi64((__m128i*)(u + i), _mm_packus_epi16(tu, tu));
+        _mm_storel_epi64((__m128i*)(v + i), _mm_packus_epi16(tv, tv));
+    }
+#endif
+    for (; i < count; ++i)
+        YuvScalar(rgba[i], y + i, u + i, v + i);
+}
+
+VideoWriter::~VideoWriter(){
+    Close();
+}
+
+int VideoWriter::Open(string path, int width, int height, int pool_frames){
+    Close();
+    const size_t n = path.size();
+    format_ = n > 4 && path.compare(n - 4, 4, ".y4m") == 0 ? VIDEO_Y4M : VIDEO_PPM;
+    if (n > 1 && path[0] == '|') {
+        file_ = popen(path.c_str() + 1, "w");
+        pipe_ = true;
+    }
+    else {
+        file_ = fopen(path.c_str(), "wb");
+    }
+    if (!file_) return ERROR_FILE_NOT_EXIST;
+
+    width_ = width;
+    height_ = height;
+    pool_.assign(pool_frames, vector<uint32_t>((size_t)width * height));
+    free_.clear();
+    for (int i = 0; i != pool_frames; ++i) free_.push_back(i);
+    queue_.assign(pool_frames, 0);
+    head_ = 0;
+    count_ = 0;
+    closing_ = false;
+    frames_ = 0;
+    stalls_ = 0;
+
+    if (format_ == VIDEO_Y4M)
+        fprintf(file_, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C444\n", width_, height_);
+    writer_ = thread(&VideoWriter::Writer, this);
+    return 0;
+}
+
+void VideoWriter::Push(const uint32_t* rgba){
+    if (!file_) return;
+    int index;
+    {
+        unique_lock<mutex> guard(lock_);
+        if (free_.empty()) {
+            ++stalls_;
+            released_.wait(guard, [this]{ return !free_.empty(); });
+        }
+        index = free_.back();
+        free_.pop_back();
+    }
+    memcpy(pool_[index].data(), rgba, pool_[index].size() * sizeof(uint32_t));
+    {
+        lock_guard<mutex> guard(lock_);
+        queue_[(head_ + count_) % queue_.size()] = index;
+        ++count_;
+        ++frames_;
+    }
+    ready_.notify_one();
+}
+
+void VideoWriter::WriteFrame(const uint32_t* rgba, vector<uint8_t>& out){
+    const size_t pixels = (size_t)width_ * height_;
+    if (format_ == VIDEO_Y4M) {
+        static const char tag[] = "FRAME\n";
+        out.resize(sizeof(tag) - 1 + pixels * 3);
+        memcpy(out.data(), tag, sizeof(tag) - 1);
+        uint8_t* y = out.data() + sizeof(tag) - 1;
+        RgbaToYuv444(rgba, pixels, y, y + pixels, y + pixels * 2);
+    }
+    else {
+        char head[32];
+        const int length = snprintf(head, sizeof(head), "P6\n%d %d\n255\n", width_, height_);
+        out.resize(length + pixels * 3);
+        memcpy(out.data(), head, length);
+        uint8_t* p = out.data() + length;
+        for (size_t i = 0; i != pixels; ++i) {
+            const uint32_t px = rgba[i];
+            p[0] = (uint8_t)px;
+            p[1] = (uint8_t)(px >> 8);
+            p[2] = (uint8_t)(px >> 16);
+            p += 3;
+        }
+    }
+    fwrite(out.data(), 1, out.size(), file_);
+}
+
+void VideoWriter::Writer(){
+    vector<uint8_t> out;
+    for (;;) {
+        int index;
+        {
+            unique_lock<mutex> guard(lock_);
+            ready_.wait(guard, [this]{ return count_ || closing_; });
+            if (!count_) return;
+            index = queue_[head_];
+            head_ = (head_ + 1) % queue_.size();
+            --count_;
+        }
+        WriteFrame(pool_[index].data(), out);
+        {
+            lock_guard<mutex> guard(lock_);
+            free_.push_back(index);
+        }
+        released_.notify_one();
+    }
+}
+
+int VideoWriter::Close(){
+    if (!file_) return 0;
+    {
+        lock_guard<mutex> guard(lock_);
+        closing_ = true;
+    }
+    ready_.notify_one();
+    // the writer drains the queue before leaving
+    writer_.join();
+    int code = 0;
+    if (pipe_) code = pclose(file_);
+    else code = fclose(file_);
+    file_ = nullptr;
+    pipe_ = false;
+    return code ? ERROR_FILED : 0;
+}
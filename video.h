@@ -0,0 +1,63 @@
+#ifndef SFCE_VIDEO_H_
+#define SFCE_VIDEO_H_
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+using namespace std;
+
+// stream format
+enum
+{
+    VIDEO_PPM = 0,  // 连续的P6图像(RGB)
+    VIDEO_Y4M,      // YUV4MPEG2, 4:4:4
+};
+
+// Frame sink for headless captures.
+// Push() copies a RGBA frame into a pooled buffer and returns, a writer
+// thread converts and writes it. The caller only waits when every pooled
+// buffer is still queued (explicit backpressure).
+class VideoWriter
+{
+private:
+    FILE*   file_ = nullptr;
+    bool    pipe_ = false;
+    int     format_ = VIDEO_PPM;
+    int     width_ = 0;
+    int     height_ = 0;
+
+    // pooled frame buffers, ring of queued indices
+    vector<vector<uint32_t> > pool_;
+    vector<int>     free_;
+    vector<int>     queue_;
+    size_t          head_ = 0;
+    size_t          count_ = 0;
+    bool            closing_ = false;
+    mutex           lock_;
+    condition_variable ready_;
+    condition_variable released_;
+    thread          writer_;
+
+    uint64_t frames_ = 0;
+    uint64_t stalls_ = 0;
+
+    void Writer();
+    void WriteFrame(const uint32_t* rgba, vector<uint8_t>& out);
+public:
+    ~VideoWriter();
+    // path: "|command" for a pipe, *.y4m for Y4M, else PPM
+    int Open(string path, int width, int height, int pool_frames = 8);
+    bool IsOpen() const { return file_ != nullptr; }
+    void Push(const uint32_t* rgba);
+    int Close();
+    uint64_t Frames() const { return frames_; }
+    uint64_t Stalls() const { return stalls_; }
+};
+
+// BT.601 (limited range) conversion of `count` RGBA pixels to planar Y, U, V
+void RgbaToYuv444(const uint32_t* rgba, size_t count, uint8_t* y, uint8_t* u, uint8_t* v);
+
+#endif